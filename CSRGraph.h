@@ -0,0 +1,130 @@
+/*
+ * CSRGraph.h
+ * Function: compressed sparse row (CSR) graph and thread pool helper shared by ogrNew.cpp, trajectory.cpp, and process.cpp
+ */
+#ifndef CSRGRAPH_H
+#define CSRGRAPH_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+struct CSREdge//directed edge of an edge list
+{
+    int ID1, ID2;
+    int distance;//meter
+    int time;//second
+};
+
+struct CSRGraph
+{
+    int nodeNum=0;
+    std::vector<unsigned long long int> offsets;//the out-edges of vertex v are at [offsets[v], offsets[v+1])
+    std::vector<int> adjacency;//end vertex of each edge
+    std::vector<int> distance;//distance of each edge, empty if not stored
+    std::vector<int> time;//travel time of each edge, empty if not stored
+
+    unsigned long long int EdgeNum() const { return adjacency.size(); }
+    int Degree(int v) const { return offsets[v+1]-offsets[v]; }
+    long long int Find(int ID1, int ID2) const;//position of the first edge (ID1,ID2), -1 if not found
+    void Build(int node_num, const std::vector<CSREdge>& edges, bool ifDistance, bool ifTime, int threadNum=1);
+    void RemoveDuplicates();//keep only the first edge (ID1,ID2) of each vertex pair
+};
+
+//function of running task(0) to task(taskNum-1) with a pool of threadNum workers, the tasks are run in place if there is only one worker
+inline void ParallelFor(int taskNum, int threadNum, const std::function<void(int)>& task){
+    threadNum=std::min(threadNum,taskNum);
+    if(threadNum<=1){
+        for(int i=0;i<taskNum;++i){
+            task(i);
+        }
+        return;
+    }
+    std::atomic<int> nextTask(0);
+    std::vector<std::thread> workers;
+    for(int ti=0;ti<threadNum;++ti){
+        workers.emplace_back([&](){
+            int i;
+            while((i=nextTask++)<taskNum){
+                task(i);
+            }
+        });
+    }
+    for(auto& worker: workers){
+        worker.join();
+    }
+}
+
+inline long long int CSRGraph::Find(int ID1, int ID2) const{
+    for(unsigned long long int i=offsets[ID1];i<offsets[ID1+1];++i){
+        if(adjacency[i]==ID2) return i;
+    }
+    return -1;
+}
+
+//function of building the graph from an edge list by counting sort on the start vertex, the out-edges of each vertex keep their order in the edge list
+inline void CSRGraph::Build(int node_num, const std::vector<CSREdge>& edges, bool ifDistance, bool ifTime, int threadNum){
+    nodeNum=node_num;
+    threadNum=std::max(1,std::min<int>(threadNum,edges.size()/65536+1));//not worth a thread for less than 65536 edges
+    unsigned long long int chunk=(edges.size()+threadNum-1)/threadNum;
+    /// Step 1: count the out-edges of each vertex in each chunk of the edge list
+    std::vector<std::vector<unsigned long long int>> counts(threadNum);
+    ParallelFor(threadNum,threadNum,[&](int t){//one chunk per task
+        counts[t].assign(nodeNum,0);
+        unsigned long long int end=std::min<unsigned long long int>(edges.size(),(t+1)*chunk);
+        for(unsigned long long int i=t*chunk;i<end;++i){
+            counts[t][edges[i].ID1]++;
+        }
+    });
+    /// Step 2: prefix sum, counts[t][v] becomes the first position of chunk t in the out-edges of v
+    offsets.assign(nodeNum+1,0);
+    unsigned long long int sum=0;
+    for(int v=0;v<nodeNum;++v){
+        offsets[v]=sum;
+        for(int t=0;t<threadNum;++t){
+            unsigned long long int c=counts[t][v];
+            counts[t][v]=sum;
+            sum+=c;
+        }
+    }
+    offsets[nodeNum]=sum;
+    /// Step 3: scatter the edges
+    adjacency.assign(edges.size(),0);
+    distance.assign(ifDistance?edges.size():0,0);
+    time.assign(ifTime?edges.size():0,0);
+    ParallelFor(threadNum,threadNum,[&](int t){//one chunk per task
+        unsigned long long int end=std::min<unsigned long long int>(edges.size(),(t+1)*chunk);
+        for(unsigned long long int i=t*chunk;i<end;++i){
+            unsigned long long int pos=counts[t][edges[i].ID1]++;
+            adjacency[pos]=edges[i].ID2;
+            if(ifDistance) distance[pos]=edges[i].distance;
+            if(ifTime) time[pos]=edges[i].time;
+        }
+    });
+}
+
+inline void CSRGraph::RemoveDuplicates(){
+    std::vector<int> lastStart(nodeNum,-1);//the last start vertex that has an edge to the vertex
+    unsigned long long int pos=0;
+    for(int v=0;v<nodeNum;++v){
+        unsigned long long int begin=offsets[v], end=offsets[v+1];
+        offsets[v]=pos;
+        for(unsigned long long int i=begin;i<end;++i){
+            int u=adjacency[i];
+            if(lastStart[u]==v) continue;//duplicate
+            lastStart[u]=v;
+            adjacency[pos]=u;
+            if(!distance.empty()) distance[pos]=distance[i];
+            if(!time.empty()) time[pos]=time[i];
+            pos++;
+        }
+    }
+    offsets[nodeNum]=pos;
+    adjacency.resize(pos); adjacency.shrink_to_fit();
+    if(!distance.empty()){ distance.resize(pos); distance.shrink_to_fit(); }
+    if(!time.empty()){ time.resize(pos); time.shrink_to_fit(); }
+}
+
+#endif //CSRGRAPH_H
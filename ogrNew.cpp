@@ -7,6 +7,9 @@
  */
 #include <ogrsf_frmts.h>
 #include <gdal.h>
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,6,0)
+#include <ogr_recordbatch.h>
+#endif
 #include <iostream>
 #include <iomanip>
 #include <sstream>
@@ -17,33 +20,154 @@
 #include <unordered_set>
 #include <stack>
 #include <string>
+#include <string_view>
+#include <charconv>
+#include <cstdint>
 #include <stdlib.h>
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/classification.hpp>
+#include "CSRGraph.h"
 
 using namespace std;
 
+const vector<int> edgeFields={1,2,3,4,5,6,9,10,12,24,27,33,34};//fields of polyline.shp written by WriteEdgeLine
+const vector<int> nodeFields={1,4,5,6,7,8,9,11,12};//fields of point.shp written by WriteNodeLine
+const vector<int> edgeGraphFields={1,5,9,10,12,24};//fields of polyline.shp read by ReadEdge
+const vector<int> nodeGraphFields={1,11};//fields of point.shp read by ReadNode
+
+struct RoadNode//vertex of point.shp
+{
+    unsigned long long int ID;
+    unsigned long long int adjoinID;//ID of the same vertex in the adjoining dataset, 0 if none
+    double lon=0, lat=0;
+};
+
+struct RoadEdge//edge of polyline.shp
+{
+    long long int ID;
+    unsigned long long int ID1, ID2;//source and end vertex ID
+    int length;//meter
+    int direction;//0 or 1: both directions, 2: from ID1 to ID2, 3: from ID2 to ID1
+    int speedClass;
+};
+
+struct IDHashMap//open addressing hash map from original vertex ID to new ID, with linear probing
+{
+    vector<unsigned long long int> keys;
+    vector<int> values;//-1: empty slot
+    size_t num=0;
+    IDHashMap(){ Rehash(16); }
+    size_t size() const { return num; }
+    void Reserve(size_t n){ if(2*n>keys.size()) Rehash(2*n); }
+    int* Find(unsigned long long int key);//nullptr if not found
+    int& operator[](unsigned long long int key);//insert 0 if not found, as map
+    void Insert(unsigned long long int key, int value){ if(Find(key)==nullptr) (*this)[key]=value; }
+    vector<pair<unsigned long long int,int>> Sorted() const;//entries in the order of key
+    void Rehash(size_t capacity);
+    size_t Slot(unsigned long long int key) const {//splitmix64 finalizer
+        key ^= key >> 30; key *= 0xbf58476d1ce4e5b9ULL;
+        key ^= key >> 27; key *= 0x94d049bb133111ebULL;
+        key ^= key >> 31;
+        return key & (keys.size()-1);
+    }
+};
+
+struct FeatureRow//fields of one feature read by GetNextFeature
+{
+    OGRFeature* poFeature;
+    string_view String(int i){ return poFeature->GetFieldAsString(i); }
+    double Double(int i){ return poFeature->GetFieldAsDouble(i); }
+    int Integer(int i){ return poFeature->GetFieldAsInteger(i); }
+    bool Point(double& x, double& y);//first point of the MultiPoint geometry
+};
+
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,6,0)
+struct ArrowColumn//one typed column of an Arrow batch, the values are converted as OGRFeature::GetFieldAs* does
+{
+    const ArrowArray* array=nullptr;
+    char format=0;//'u'/'U': (large) string, 'z'/'Z': (large) binary, 'c'/'s'/'i'/'l': int8/16/32/64, 'f'/'g': float/double
+    int64_t offset=0;//offset of the batch plus offset of the column
+    int width=0, precision=0;//of real fields
+    char buffer[64];//text of the last numeric value
+    bool IsNull(int64_t r) const;
+    string_view String(int64_t r);//as GetFieldAsString, empty if null
+    double Double(int64_t r);
+    long long Integer(int64_t r);
+};
+
+struct ArrowRow//fields of row r of an Arrow batch
+{
+    vector<ArrowColumn> columns;//by field index, only the read fields are set
+    ArrowColumn geometry;//WKB
+    int64_t r=0;
+    string_view String(int i){ return columns[i].String(r); }
+    double Double(int i){ return columns[i].Double(r); }
+    int Integer(int i){ return columns[i].Integer(r); }
+    bool Point(double& x, double& y);//first point of the MultiPoint geometry
+};
+#endif
+
 vector<string> split(const string &s, const string &seperator);
-void NodePointProcess(char * sourceFile, char * layerName, string outputFile);
-void EdgePolylineProcess(char * sourceFile, char * layerName, string outputFile);
-void GetRoadNetwork(string edgeFile, string nodeFile, string sourcePath);
-void GetRoadNetworkAggregation(string sourcePath, string targetPath, vector<string>& datasets, string tragetName);
+bool NodePointProcess(char * sourceFile, char * layerName, vector<RoadNode>& nodes, string dumpFile, ostream& log);
+bool EdgePolylineProcess(char * sourceFile, char * layerName, vector<RoadEdge>& roadEdges, string dumpFile, ostream& log);
+void GetRoadNetwork(vector<RoadNode>& nodes, vector<RoadEdge>& roadEdges, string sourcePath);
+void GetRoadNetworkAggregation(vector<vector<RoadNode>>& datasetNodes, vector<vector<RoadEdge>>& datasetEdges, string targetPath, string tragetName);
 void RoadNetworkPreprocess(string graph_path);
-template <class T>
-pair<int, unsigned long long int> DFS_CC(T & Edges, unordered_set<int> & set_A, set<int> & set_LCC, int nodenum);
+pair<int, unsigned long long int> DFS_CC(CSRGraph & Edges, unordered_set<int> & set_A, set<int> & set_LCC, int nodenum);
 double ComputeDiameter(vector<pair<double,double>> & points);
 double EuclideanDis(pair<double,double> s, pair<double,double> t);
+unsigned long long int GridCell(long long int x, long long int y);
+template <class Row>
+void WriteEdgeLine(ofstream& ofile, Row& row);
+template <class Row>
+void WriteNodeLine(ofstream& ofile, Row& row);
+template <class Row>
+bool ReadEdge(Row& row, RoadEdge& edge);
+template <class Row>
+bool ReadNode(Row& row, RoadNode& node, bool& ifPoint);
+bool ToInteger(string_view s, long long int& value);
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,6,0)
+template <class Write>
+bool ReadLayerArrow(OGRLayer* poLayer, const vector<int>& fields, bool ifGeometry, Write write, bool& ifSuccess, ostream& log);
+#endif
 
 bool ifNew=true;
+bool ifDump=false;//whether to write the .node and .edge text files of each dataset
+double snapTolerance=0;//vertices of different datasets closer than it (degree) are merged in aggregation, 0: disabled
+int threadNum=1;//worker number for reading the datasets to aggregate and building the graph
 
 int main(int argc, char** argv){
+    //options may appear anywhere, the remaining arguments are positional
+    vector<char*> args;
+    for(int i=0;i<argc;++i){
+        if(strcmp(argv[i],"--dump")==0){
+            ifDump=true;
+        }else if(strcmp(argv[i],"--threads")==0 && i+1<argc){
+            threadNum=max(1,stoi(argv[++i]));
+        }else if(strcmp(argv[i],"--snap")==0 && i+1<argc){
+            snapTolerance=stod(argv[++i]);
+            if(snapTolerance<0 || (snapTolerance>0 && snapTolerance<1e-7)){
+                cout<<"Wrong snap tolerance! "<<snapTolerance<<endl; exit(1);
+            }
+        }else{
+            args.push_back(argv[i]);
+        }
+    }
+    argc=args.size(); argv=args.data();
+
     if( argc < 4){//
         printf("usage:\n<arg1> source path, e.g /data/TrajectoryData/map/\n");
         printf("<arg2> target path, e.g. /data/xzhouby/datasets/map/Guangdong/\n");
         printf("<arg3> name of dataset, e.g. Guangdong\n");
         printf("<arg4> aggregate road networks? (optional), 0: No, 1: Yes. Default: 0\n");
         printf("<arg5> name of aggregated datasets (optional), eg. guangdong1 guangdong2 guangzhou\n");
+        printf("--dump (optional), also write the vertices and edges read from the .shp files to <source path><dataset>/road/<dataset>.node and .edge\n");
+        printf("--threads N (optional), worker number for reading the datasets to aggregate and building the graph. default: 1\n");
+        printf("--snap D (optional), merge the vertices of different aggregated datasets whose longitude and latitude both differ by at most D degree (at least 1e-7). default: 0 (disabled)\n");
         exit(0);
     }
     bool ifAggregate=false;
@@ -91,7 +215,10 @@ int main(int argc, char** argv){
         strcpy(char_array1, source1.c_str());
         char* char_layer1 = new char[layer1.length() + 1];
         strcpy(char_layer1, layer1.c_str());
-        NodePointProcess(char_array1,char_layer1,inPath+dataset+".node");
+        vector<RoadNode> nodes;
+        if(!NodePointProcess(char_array1,char_layer1,nodes,ifDump?inPath+dataset+".node":"",cout)){
+            exit(1);
+        }
         delete[] char_array1; delete[] char_layer1;
 
         /// Step 2: get the original edge information
@@ -102,50 +229,69 @@ int main(int argc, char** argv){
         strcpy(char_array2, source2.c_str());
         char* char_layer2 = new char[layer2.length() + 1];
         strcpy(char_layer2, layer2.c_str());
-        EdgePolylineProcess(char_array2,char_layer2,inPath+dataset+".edge");
+        vector<RoadEdge> roadEdges;
+        if(!EdgePolylineProcess(char_array2,char_layer2,roadEdges,ifDump?inPath+dataset+".edge":"",cout)){
+            exit(1);
+        }
         delete[] char_array2; delete[] char_layer2;
 
         /// Step 3: get the original road network
         cout<<"Step 3: get the original road network"<<endl;
         //For single data source
-        GetRoadNetwork(inPath+dataset+".edge",inPath+dataset+".node",targetPath+dataset);
+        GetRoadNetwork(nodes,roadEdges,targetPath+dataset);
     }
     else{//aggregation of multiple datasets
-        string dataset="fujian";
-        string inPath;
         cout<<"Aggregate multiple road networks"<<endl;
-        for(int i=0;i<datasets.size();++i){
-            dataset=datasets[i];
-            inPath=sourcePath+dataset+"/road/";
+        vector<vector<RoadNode>> datasetNodes(datasets.size());
+        vector<vector<RoadEdge>> datasetEdges(datasets.size());
+        vector<stringstream> datasetLogs(datasets.size());
+        vector<char> datasetRead(datasets.size(),0);//whether the dataset is read successfully, the workers do not exit by themselves
+        cout<<"Reading "<<datasets.size()<<" datasets with "<<min<int>(threadNum,datasets.size())<<" threads."<<endl;
+        ParallelFor(datasets.size(), threadNum, [&](int i){//each dataset is read with its own GDAL dataset handles
+            string dataset=datasets[i];
+            string inPath=sourcePath+dataset+"/road/";
+            ostream& log=threadNum>1? datasetLogs[i] : cout;//the logs of the workers are printed in dataset order
 
             /// Step 1: get the original vertex information
-            cout<<"Step 1: get the original vertex information"<<endl;
+            log<<"Step 1: get the original vertex information"<<endl;
             string layer1="N"+dataset+"_point";
             string source1=inPath+layer1+".shp";
             char* char_array1 = new char[source1.length() + 1];
             strcpy(char_array1, source1.c_str());
             char* char_layer1 = new char[layer1.length() + 1];
             strcpy(char_layer1, layer1.c_str());
-            NodePointProcess(char_array1,char_layer1,inPath+dataset+".node");
+            bool ifRead=NodePointProcess(char_array1,char_layer1,datasetNodes[i],ifDump?inPath+dataset+".node":"",log);
             delete[] char_array1; delete[] char_layer1;
+            if(!ifRead) return;
 
             /// Step 2: get the original edge information
-            cout<<"Step 2: get the original edge information"<<endl;
+            log<<"Step 2: get the original edge information"<<endl;
             string layer2="R"+dataset+"_polyline";
             string source2=inPath+layer2+".shp";
             char* char_array2 = new char[source2.length() + 1];
             strcpy(char_array2, source2.c_str());
             char* char_layer2 = new char[layer2.length() + 1];
             strcpy(char_layer2, layer2.c_str());
-            EdgePolylineProcess(char_array2,char_layer2,inPath+dataset+".edge");
+            ifRead=EdgePolylineProcess(char_array2,char_layer2,datasetEdges[i],ifDump?inPath+dataset+".edge":"",log);
             delete[] char_array2; delete[] char_layer2;
+            datasetRead[i]=ifRead;
+        });
+        for(auto& log: datasetLogs){
+            cout<<log.str();
         }
-
+        bool ifFailed=false;
+        for(int i=0;i<datasets.size();++i){
+            if(!datasetRead[i]){
+                cout<<"Read dataset "<<datasets[i]<<" failed!"<<endl;
+                ifFailed=true;
+            }
+        }
+        if(ifFailed) exit(1);
 
         /// Step 3: get the original road network
         cout<<"Step 3: get the original road network"<<endl;
         //For multiple data sources
-        GetRoadNetworkAggregation(sourcePath, targetPath, datasets, dataSet);
+        GetRoadNetworkAggregation(datasetNodes, datasetEdges, targetPath, dataSet);
 
 
     }
@@ -157,20 +303,17 @@ int main(int argc, char** argv){
     return 0;
 }
 
-void GetRoadNetworkAggregation(string sourcePath, string targetPath, vector<string>& datasets, string targetName){
+void GetRoadNetworkAggregation(vector<vector<RoadNode>>& datasetNodes, vector<vector<RoadEdge>>& datasetEdges, string targetPath, string targetName){
     ifstream IFOut(targetPath + targetName + "_Distance.gr");
     if (IFOut.is_open() && !ifNew) {//already exist
-        cout << "File " << sourcePath + targetName + "_Distance.gr" << " already exists."<< endl;
+        cout << "File " << targetPath + targetName + "_Distance.gr" << " already exists."<< endl;
       IFOut.close();
     }
     else{
         IFOut.close();
-        vector<string> vs;
-        string line;
         unsigned long long int ID1, ID2;
         long long int edgeID;
         int weightD, weightT;
-        int lineNum = 0;
         vector<tuple<int, int, int, int>> edges;//ID1,ID2,length (m),travel time (s)
         map<int, int> speedClass;
         double speedMap[7] = {33.33, 27.77, 22.22, 16.66, 11.11, 8.33,
@@ -178,55 +321,89 @@ void GetRoadNetworkAggregation(string sourcePath, string targetPath, vector<stri
         int speedClassTemp = 0;
         int direction;
         int lineNum2 = 0;
-        map<unsigned long long int, int> IDMap;//map vertex ID from old to new
+        IDHashMap IDMap;//map vertex ID from old to new
         map<long long int, pair<int,int>> EdgeToNodeMap;//map old edge ID to its endpoints' new ID
         map<long long int, int> EdgeIDMap;//map edge ID to new ID
 //        set<long long int> EdgeIDs;//collection of edge ID
         int newID = 0;
         double speedTemp;
-        map<int, pair<double,double>> nodeGPS;// new ID to its coordinate
+        vector<pair<double,double>> nodeGPS;// new ID to its coordinate
         double minLon=INT16_MAX, minLat=INT16_MAX;
         double maxLon=-INT16_MAX, maxLat=-INT16_MAX;
         int edgeIDnew=0;
-
-        for(int di=0;di<datasets.size();++di){
-            string sourcePath1 = sourcePath+datasets[di]+"/road/";
-            string nodeFile=sourcePath1 + datasets[di] + ".node";
-            ifstream nodeIF(nodeFile, ios::in);
-            if (!nodeIF.is_open()) {
-                cout << "Open node file failed!" << nodeFile << endl;
-                exit(1);
-            }
-            getline(nodeIF, line);
-            getline(nodeIF, line);
-            vs = split(line, " \t");
-            lineNum = 0;
-            if (vs.size() == 1) {
-                lineNum = stoi(vs[0]);
-                cout << "Node number: " << lineNum << endl;
-            } else {
-                cout << "Wrong syntax! " << line << endl;
-                exit(1);
-            }
+        size_t nodeNum=0;
+        for(auto& nodes: datasetNodes) nodeNum+=nodes.size();
+        IDMap.Reserve(nodeNum);
+        nodeGPS.reserve(nodeNum);
+        IDHashMap cellHead;//grid cell of snapTolerance to its last new vertex
+        vector<int> cellNext;//new ID to the previous new vertex in the same cell, -1 if none
+        vector<int> nodeSnapped;//new ID to the last dataset taking it by snapping or adjoin ID, -1 if none
+        int snapNum=0;
+        int loopNum=0;//edges whose two endpoints are mapped to the same new vertex
+
+        for(int di=0;di<datasetNodes.size();++di){
+            cout << "Node number: " << datasetNodes[di].size() << endl;
             double lat, lon;
-            lineNum2=0;
-            while(getline(nodeIF,line))
-            {
-                if(line=="") continue;
-                vs.clear();
-                vs = split(line," \t");
-                if(vs.size()<4){
-                    cout<<"Wrong syntax! "<<line<<endl; exit(1);
+            vector<int> nodeSnap;//node of this dataset to the vertex of an earlier dataset it snaps onto, -1 if none
+            if(snapTolerance>0){//each vertex takes at most one vertex of this dataset, otherwise two vertices of this dataset are merged
+                nodeSnap.assign(datasetNodes[di].size(),-1);
+                for(const RoadNode& node: datasetNodes[di]){//the vertices taken by the adjoin ID
+                    int* adjoin=IDMap.Find(node.adjoinID);
+                    if(adjoin!=nullptr) nodeSnapped[*adjoin]=di;
+                }
+                vector<tuple<double,int,int>> snapPairs;//squared distance, node of this dataset, vertex of an earlier dataset
+                for(int i=0;i<datasetNodes[di].size();++i){//look for the vertices of earlier datasets in the 3x3 cells around
+                    const RoadNode& node=datasetNodes[di][i];
+                    if(IDMap.Find(node.adjoinID)!=nullptr) continue;
+                    long long int cx=floor(node.lon/snapTolerance), cy=floor(node.lat/snapTolerance);
+                    for(long long int x=cx-1;x<=cx+1;++x){
+                        for(long long int y=cy-1;y<=cy+1;++y){
+                            int* head=cellHead.Find(GridCell(x,y));
+                            for(int v=head==nullptr?-1:*head;v!=-1;v=cellNext[v]){
+                                double dLon=nodeGPS[v].first-node.lon, dLat=nodeGPS[v].second-node.lat;
+                                if(nodeSnapped[v]!=di && abs(dLon)<=snapTolerance && abs(dLat)<=snapTolerance){
+                                    snapPairs.emplace_back(dLon*dLon+dLat*dLat,i,v);
+                                }
+                            }
+                        }
+                    }
+                }
+                sort(snapPairs.begin(),snapPairs.end());//the nearest pairs are matched first
+                for(auto& [dis,i,v]: snapPairs){
+                    if(nodeSnap[i]==-1 && nodeSnapped[v]!=di){
+                        nodeSnap[i]=v; nodeSnapped[v]=di;
+                    }
                 }
-                ID1=stoull(vs[0]), lon=stod(vs[1]), lat=stod(vs[2]), ID2=stoull(vs[vs.size()-1]);
+            }
+            for(int i=0;i<datasetNodes[di].size();++i)
+            {
+                const RoadNode& node=datasetNodes[di][i];
+                ID1=node.ID, lon=node.lon, lat=node.lat, ID2=node.adjoinID;
                 //!!! a vertex has two ID, ID1 and ID2
-                if(IDMap.find(ID1)==IDMap.end()){//if not found ID1
-                    if(IDMap.find(ID2)==IDMap.end()){//if not found ID2
-                        nodeGPS.insert({newID, make_pair(lon,lat)});
-                        IDMap.insert({ID1,newID});
-                        newID++;
+                if(IDMap.Find(ID1)==nullptr){//if not found ID1
+                    if(IDMap.Find(ID2)==nullptr){//if not found ID2
+                        int snapID=-1;
+                        long long int cx=0, cy=0;
+                        if(snapTolerance>0){
+                            snapID=nodeSnap[i];
+                            cx=floor(lon/snapTolerance), cy=floor(lat/snapTolerance);
+                        }
+                        if(snapID!=-1){//snap to the vertex found
+                            IDMap.Insert(ID1,snapID);
+                            snapNum++;
+                        }else{
+                            nodeGPS.emplace_back(lon,lat);
+                            IDMap.Insert(ID1,newID);
+                            if(snapTolerance>0){
+                                int* head=cellHead.Find(GridCell(cx,cy));
+                                cellNext.push_back(head==nullptr?-1:*head);
+                                nodeSnapped.push_back(-1);
+                                cellHead[GridCell(cx,cy)]=newID;
+                            }
+                            newID++;
+                        }
                     }else{//if found ID2
-                        IDMap.insert({ID1,IDMap[ID2]});
+                        IDMap.Insert(ID1,IDMap[ID2]);
                     }
 
                 }else{//if found ID1
@@ -240,42 +417,20 @@ void GetRoadNetworkAggregation(string sourcePath, string targetPath, vector<stri
 
                 lineNum2++;
             }
-            if(lineNum!=lineNum2){
-                cout<<"Inconsistent ID number."<<endl; exit(1);
-            }
 
-            string edgeFile=sourcePath1 + datasets[di] + ".edge";
-            ifstream edgeIF(edgeFile, ios::in);
-            if (!edgeIF.is_open()) {
-                cout << "Open edge file failed!" << edgeFile << endl;
-                exit(1);
-            }
-
-            getline(edgeIF, line);
-            getline(edgeIF, line);
-            vs = split(line, " \t");
-
-            if (vs.size() == 1) {
-                lineNum = stoi(vs[0]);
-                cout << "Edge number: " << lineNum << endl;
-            } else {
-                cout << "Wrong syntax! " << line << endl;
-                exit(1);
-            }
-
-            while (getline(edgeIF, line)) {
-                if (line == "") continue;
-                vs.clear();
-                vs = split(line, " \t");
-                if (vs.size() < 11) {
-                    cout << "Wrong syntax! " << line << endl;
-                    exit(1);
+            cout << "Edge number: " << datasetEdges[di].size() << endl;
+            for(const RoadEdge& edge: datasetEdges[di]) {
+                ID1 = edge.ID1, ID2 = edge.ID2, weightD = edge.length, speedClassTemp = edge.speedClass;
+                direction = edge.direction;
+                edgeID = edge.ID;
+                int newID1=IDMap[ID1], newID2=IDMap[ID2];//looked up once, the references of IDMap are invalidated by insertion
+                if(newID1==newID2){//both endpoints are merged into one vertex, skip the self-loop
+                    cout<<"Skip self-loop edge! "<<edgeID<<" "<<ID1<<" "<<ID2<<" "<<newID1<<endl;
+                    loopNum++; lineNum2++;
+                    continue;
                 }
-                ID1 = stoull(vs[3]), ID2 = stoull(vs[4]), weightD = stoi(vs[2]), speedClassTemp = stoi(vs[5]);
-                direction = stoi(vs[1]);
-                edgeID = stoll(vs[0]);
 
-                double weightEuc= EuclideanDis(nodeGPS[IDMap[ID1]],nodeGPS[IDMap[ID2]]);
+                double weightEuc= EuclideanDis(nodeGPS[newID1],nodeGPS[newID2]);
                 if(weightD<weightEuc){
                     int newWeiD=max(weightEuc+2,weightEuc*1.05);
                     cout<<"Invalid edge distance! "<<ID1<<" "<<ID2<<" "<<weightD<<" "<<weightEuc<<" "<< newWeiD<<endl;
@@ -286,7 +441,7 @@ void GetRoadNetworkAggregation(string sourcePath, string targetPath, vector<stri
                 if(EdgeIDMap.find(edgeID)==EdgeIDMap.end()){//if not found
                     EdgeIDMap.insert({edgeID,edgeIDnew});
                     edgeIDnew++;
-                    EdgeToNodeMap.insert({edgeID, make_pair(IDMap[ID1],IDMap[ID2])});
+                    EdgeToNodeMap.insert({edgeID, make_pair(newID1,newID2)});
                 }else{
                     cout<<"Already exist! "<<edgeID<<endl; exit(1);
                 }
@@ -303,12 +458,12 @@ void GetRoadNetworkAggregation(string sourcePath, string targetPath, vector<stri
                 }
 
                 if(direction == 1 || direction == 0){
-                    edges.emplace_back(IDMap[ID1], IDMap[ID2], weightD, weightT);
-                    edges.emplace_back(IDMap[ID2], IDMap[ID1], weightD, weightT);
+                    edges.emplace_back(newID1, newID2, weightD, weightT);
+                    edges.emplace_back(newID2, newID1, weightD, weightT);
                 }else if(direction == 2){
-                    edges.emplace_back(IDMap[ID1], IDMap[ID2], weightD, weightT);
+                    edges.emplace_back(newID1, newID2, weightD, weightT);
                 }else if(direction == 3){
-                    edges.emplace_back(IDMap[ID2], IDMap[ID1], weightD, weightT);
+                    edges.emplace_back(newID2, newID1, weightD, weightT);
                 }else{
                     cout<<"Wrong direction! "<<direction<<endl; exit(1);
                 }
@@ -320,6 +475,12 @@ void GetRoadNetworkAggregation(string sourcePath, string targetPath, vector<stri
         }
 
 
+        if(snapTolerance>0){
+            cout<<"Snapped vertices: "<<snapNum<<endl;
+        }
+        if(loopNum>0){
+            cout<<"Skipped self-loop edges: "<<loopNum<<endl;
+        }
         if(nodeGPS.size()!=newID){
             cout<<"Inconsistent node number! "<<newID<<" "<<nodeGPS.size()<<endl; exit(1);
         }
@@ -334,7 +495,7 @@ void GetRoadNetworkAggregation(string sourcePath, string targetPath, vector<stri
 
         ofstream OF1(targetPath + targetName + "_Distance.gr");
         if (!OF1.is_open()) {
-            cout << "Open file failed!" << sourcePath + targetName + "_Distance.gr" << endl;
+            cout << "Open file failed!" << targetPath + targetName + "_Distance.gr" << endl;
             exit(1);
         }
         OF1 << newID << " " << edges.size() << endl;
@@ -346,7 +507,7 @@ void GetRoadNetworkAggregation(string sourcePath, string targetPath, vector<stri
 
         ofstream OF2(targetPath + targetName + "_Time.gr");
         if (!OF2.is_open()) {
-            cout << "Open file failed!" << sourcePath + targetName + "_Time.gr" << endl;
+            cout << "Open file failed!" << targetPath + targetName + "_Time.gr" << endl;
             exit(1);
         }
         OF2 << newID << " " << edges.size() << endl;
@@ -357,30 +518,30 @@ void GetRoadNetworkAggregation(string sourcePath, string targetPath, vector<stri
 
         ofstream OF3(targetPath + targetName + "_NodeIDMap");
         if (!OF3.is_open()) {
-            cout << "Open file failed!" << sourcePath + targetName + "_NodeIDMap" << endl;
+            cout << "Open file failed!" << targetPath + targetName + "_NodeIDMap" << endl;
             exit(1);
         }
         OF3 << newID << endl;
-        for (auto it = IDMap.begin(); it != IDMap.end(); ++it) {
-            OF3 << it->first << " " << it->second << endl;
+        for (auto& it: IDMap.Sorted()) {
+            OF3 << it.first << " " << it.second << endl;
         }
         OF3.close();
         cout<<"Finish graph generation."<<endl;
 
         ofstream OF4(targetPath + targetName + "_Coordinate.co");
         if (!OF4.is_open()) {
-            cout << "Open file failed!" << sourcePath + targetName + "_Coordinate.co" << endl;
+            cout << "Open file failed!" << targetPath + targetName + "_Coordinate.co" << endl;
             exit(1);
         }
         OF4 << nodeGPS.size() << endl;
-        for (auto it=nodeGPS.begin();it!=nodeGPS.end(); ++it) {
-            OF4 << it->first << " " << int(1000000*it->second.first) << " " << int(1000000*it->second.second) << endl;
+        for (int i=0;i<nodeGPS.size();++i) {
+            OF4 << i << " " << int(1000000*nodeGPS[i].first) << " " << int(1000000*nodeGPS[i].second) << endl;
         }
         OF4.close();
 
         ofstream OF5(targetPath + targetName + "_EdgeToNodeMap");
         if (!OF5.is_open()) {
-            cout << "Open file failed!" << sourcePath + targetName + "_EdgeToNodeMap" << endl;
+            cout << "Open file failed!" << targetPath + targetName + "_EdgeToNodeMap" << endl;
             exit(1);
         }
         OF5 << EdgeToNodeMap.size() << endl;
@@ -391,7 +552,7 @@ void GetRoadNetworkAggregation(string sourcePath, string targetPath, vector<stri
 
         ofstream OF6(targetPath + targetName + "_EdgeIDMap");
         if (!OF6.is_open()) {
-            cout << "Open file failed!" << sourcePath + targetName + "_EdgeIDMap" << endl;
+            cout << "Open file failed!" << targetPath + targetName + "_EdgeIDMap" << endl;
             exit(1);
         }
         OF6 << EdgeIDMap.size() << endl;
@@ -407,9 +568,7 @@ void GetRoadNetworkAggregation(string sourcePath, string targetPath, vector<stri
 
 
 // function of getting the road network by mapping original vertex ID to 0-start ID
-void GetRoadNetwork(string edgeFile, string nodeFile, string sourcePath) {
-    vector<string> vs;
-    string line;
+void GetRoadNetwork(vector<RoadNode>& nodes, vector<RoadEdge>& roadEdges, string sourcePath) {
     unsigned long long int ID1, ID2;
     long long int edgeID;
     int weightD, weightT;
@@ -429,37 +588,15 @@ void GetRoadNetwork(string edgeFile, string nodeFile, string sourcePath) {
     double minLon=INT16_MAX, minLat=INT16_MAX;
     double maxLon=-INT16_MAX, maxLat=-INT16_MAX;
     int edgeIDnew=0;
-    int lineNum = 0;
-    // Read node file
+    // Read vertices
     map<int, pair<double,double>> nodeGPS;// map coordinate to its new node ID
-    ifstream nodeIF(nodeFile, ios::in);
-    if (!nodeIF.is_open()) {
-        cout << "Open node file failed!" << nodeFile << endl;
-        exit(1);
-    }
-    getline(nodeIF, line);
-    getline(nodeIF, line);
-    vs = split(line, " \t");
-    lineNum = 0;
-    if (vs.size() == 1) {
-        lineNum = stoi(vs[0]);
-        cout << "Node number: " << lineNum << endl;
-    } else {
-        cout << "Wrong syntax! " << line << endl;
-        exit(1);
-    }
+    cout << "Node number: " << nodes.size() << endl;
     double lat, lon;
     lineNum2=0;
     newID=0;
-    while(getline(nodeIF,line))
+    for(const RoadNode& node: nodes)
     {
-        if(line=="") continue;
-        vs.clear();
-        vs = split(line," \t");
-        if(vs.size()<4){
-            cout<<"Wrong syntax! "<<line<<endl; exit(1);
-        }
-        ID1=stoull(vs[0]), lon=stod(vs[1]), lat=stod(vs[2]), ID2=stoull(vs[vs.size()-1]);
+        ID1=node.ID, lon=node.lon, lat=node.lat, ID2=node.adjoinID;
         //!!! a vertex has two ID, ID1 and ID2
         if(IDMap.find(ID1)==IDMap.end()){//if not found ID1
             if(IDMap.find(ID2)==IDMap.end()){//if not found ID2
@@ -481,40 +618,15 @@ void GetRoadNetwork(string edgeFile, string nodeFile, string sourcePath) {
 
         lineNum2++;
     }
-    if(lineNum!=lineNum2){
-        cout<<"Inconsistent ID number."<<endl; exit(1);
-    }
-    nodeIF.close();
     if(nodeGPS.size()!=newID){
         cout<<"Inconsistent node number! "<<newID<<" "<<nodeGPS.size()<<endl; exit(1);
     }
-    /// Read edge file
-    ifstream edgeIF(edgeFile, ios::in);
-    if (!edgeIF.is_open()) {
-        cout << "Open edge file failed!" << edgeFile << endl;
-        exit(1);
-    }
-    getline(edgeIF, line);
-    getline(edgeIF, line);
-    vs = split(line, " \t");
-    if (vs.size() == 1) {
-        lineNum = stoi(vs[0]);
-        cout << "Edge number: " << lineNum << endl;
-    } else {
-        cout << "Wrong syntax! " << line << endl;
-        exit(1);
-    }
-    while (getline(edgeIF, line)) {
-        if (line == "") continue;
-        vs.clear();
-        vs = split(line, " \t");
-        if (vs.size() < 11) {
-            cout << "Wrong syntax! " << line << endl;
-            exit(1);
-        }
-        ID1 = stoull(vs[3]), ID2 = stoull(vs[4]), weightD = stoi(vs[2]), speedClassTemp = stoi(vs[5]);
-        direction = stoi(vs[1]);
-        edgeID = stoll(vs[0]);
+    /// Read edges
+    cout << "Edge number: " << roadEdges.size() << endl;
+    for(const RoadEdge& edge: roadEdges) {
+        ID1 = edge.ID1, ID2 = edge.ID2, weightD = edge.length, speedClassTemp = edge.speedClass;
+        direction = edge.direction;
+        edgeID = edge.ID;
 
         double weightEuc= EuclideanDis(nodeGPS[IDMap[ID1]],nodeGPS[IDMap[ID2]]);
 //        cout<<ID1<<" "<<ID2<<" "<<weightD<<" "<<weightEuc<<endl;
@@ -560,7 +672,6 @@ void GetRoadNetwork(string edgeFile, string nodeFile, string sourcePath) {
 
         lineNum2++;
     }
-    edgeIF.close();
 
 
     cout << "Node number: " << nodeGPS.size() << " ; Edge number: " << edges.size() << " ("<<edgeIDnew+1<<")"<< endl;
@@ -643,246 +754,457 @@ void GetRoadNetwork(string edgeFile, string nodeFile, string sourcePath) {
 
     cout<<"Done."<<endl;
 }
-// function of extracting edge information from polyline.shp
-void EdgePolylineProcess(char * sourceFile, char * layerName, string outputFile){
-    ifstream ifile(outputFile);
-    if(!ifile.is_open()) {//not open
-        ifile.close();
-        GDALDataset *poDS;  //Data source
-        poDS = (GDALDataset*) GDALOpenEx(sourceFile, GDAL_OF_VECTOR, NULL, NULL, NULL);
-
-        if(poDS == NULL)
-        {
-            cout << "Open shp file failed!" << endl;
-            exit(1);
-        }
-        cout << "Data source open success!" << endl;
-
-        OGRLayer *poLayer;
-//    poLayer = poDS->GetLayerByName("Nfujian_point");
-        poLayer = poDS->GetLayerByName(layerName);
-        //feature is a geometry and a set of attributes
-        OGRFeature *poFeature;
-        poLayer->ResetReading();    //Start at the beginning of the layer
-        cout << "Feature number:" << poLayer->GetFeatureCount() << endl;
-        auto layerDefn=poLayer->GetLayerDefn();
-        for(int i=0;i<layerDefn->GetFieldCount();++i){
-            cout<<layerDefn->GetFieldDefn(i)->GetNameRef()<<" ";
-        }
-        cout<<endl;
-        ofstream ofile(outputFile);
+// function of extracting edge information from polyline.shp, the edges are also written to dumpFile if it is not empty
+// return false if the source cannot be read, the error is written to log and the caller exits
+bool EdgePolylineProcess(char * sourceFile, char * layerName, vector<RoadEdge>& roadEdges, string dumpFile, ostream& log){
+    GDALDataset *poDS;  //Data source
+    poDS = (GDALDataset*) GDALOpenEx(sourceFile, GDAL_OF_VECTOR, NULL, NULL, NULL);
+
+    if(poDS == NULL)
+    {
+        log << "Open shp file failed! " << sourceFile << endl;
+        return false;
+    }
+    log << "Data source open success!" << endl;
+
+    OGRLayer *poLayer;
+    poLayer = poDS->GetLayerByName(layerName);
+    //feature is a geometry and a set of attributes
+    OGRFeature *poFeature;
+    poLayer->ResetReading();    //Start at the beginning of the layer
+    log << "Feature number:" << poLayer->GetFeatureCount() << endl;
+    auto layerDefn=poLayer->GetLayerDefn();
+    for(int i=0;i<layerDefn->GetFieldCount();++i){
+        log<<layerDefn->GetFieldDefn(i)->GetNameRef()<<" ";
+    }
+    log<<endl;
+
+    bool ifDumpFile=!dumpFile.empty();
+    ofstream ofile;
+    if(ifDumpFile){
+        ofile.open(dumpFile);
         if(!ofile.is_open()){
-            cout << "Open file failed!" << outputFile << endl;
-            exit(1);
+            log << "Open file failed!" << dumpFile << endl;
+            GDALClose(poDS);
+            return false;
         }
-
         ofile << "ID\tDirection\tLength\tSNodeID\tENodeID\tSpeedClass\tSpdLmtS2E\tSpdLmtE2S\tToll\tLaneNum\tWidth\tKingNum\tKing"<<endl;
         ofile << poLayer->GetFeatureCount()<<endl;//feature number
-        while((poFeature = poLayer->GetNextFeature()) != NULL)
+    }
+
+    roadEdges.clear();
+    roadEdges.reserve(max<long long int>(poLayer->GetFeatureCount(),0));
+    auto process=[&](auto& row){
+        roadEdges.emplace_back();
+        if(!ReadEdge(row,roadEdges.back())){
+            log<<"Wrong syntax! edge "<<row.String(1)<<endl;
+            return false;
+        }
+        if(ifDumpFile) WriteEdgeLine(ofile,row);
+        return true;
+    };
+    bool ifArrow=false, ifSuccess=true;
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,6,0)
+    ifArrow=ReadLayerArrow(poLayer, ifDumpFile?edgeFields:edgeGraphFields, false, process, ifSuccess, log);//column batches
+#endif
+    if(!ifArrow){//feature by feature
+        while(ifSuccess && (poFeature = poLayer->GetNextFeature()) != NULL)
         {
-            ofile <<poFeature->GetFieldAsString(1);			//ID
+            FeatureRow row{poFeature};
+            ifSuccess=process(row);
+            OGRFeature::DestroyFeature(poFeature);
+        }
+    }
+    GDALClose(poDS);
+    if(!ifSuccess){
+        return false;
+    }
+    if(ifDumpFile){
+        ofile.close();
+        log<<"Write "<<dumpFile<<" done."<<endl;
+    }
+    log<<"Read "<<roadEdges.size()<<" edges.\n"<<endl;
+    return true;
+}
+// function of extracting node information from point.shp, the nodes are also written to dumpFile if it is not empty
+// return false if the source cannot be read, the error is written to log and the caller exits
+bool NodePointProcess(char * sourceFile, char * layerName, vector<RoadNode>& nodes, string dumpFile, ostream& log){
+    GDALDataset *poDS;  //Data source
+    poDS = (GDALDataset*) GDALOpenEx(sourceFile, GDAL_OF_VECTOR, NULL, NULL, NULL);
+
+    if(poDS == NULL)
+    {
+        log << "Open shp file failed! " << sourceFile << endl;
+        return false;
+    }
+    log << "Data source open success!" << endl;
+
+    int layerNum = poDS->GetLayerCount();   //a dataset may have many layers
+    log << "Layer number:" << layerNum << endl;
+
+    OGRLayer *poLayer;
+    poLayer = poDS->GetLayerByName(layerName);
 
-            ofile << "\t"<< poFeature->GetFieldAsString(5);	//Direction
-            auto temp=poFeature->GetFieldAsDouble(12) * 1000;
-            ofile << "\t"<< (int)temp;	                    //Length
+    //feature is a geometry and a set of attributes
+    OGRFeature *poFeature;
+    poLayer->ResetReading();    //Start at the beginning of the layer
+    log << "Feature number:" << poLayer->GetFeatureCount() << endl;
 
-            ofile << "\t" << poFeature->GetFieldAsString(9);    //Source ID
-            ofile << "\t" << poFeature->GetFieldAsString(10);   //End ID
+    auto layerDefn=poLayer->GetLayerDefn();
+    for(int i=0;i<layerDefn->GetFieldCount();++i){
+        log<<layerDefn->GetFieldDefn(i)->GetNameRef()<<" ";
+    }
+    log<<endl;
 
-            ofile << "\t" << poFeature->GetFieldAsString(24);	//Speed Limit class, 1: >130 km/h; 2: (100 km/h, 130 km/h]; 3: (90 km/h, 100 km/h]; 4: (70 km/h, 90 km/h]; 5: (50 km/h, 70 km/h]; 6: (30 km/h, 50 km/h]; 7: [11 km/h, 30 km/h]; 8: <11 km/h
-            ofile << "\t" << poFeature->GetFieldAsString(33);	//Speed Limit from source to end, 0.1 km/s
-            ofile << "\t" << poFeature->GetFieldAsString(34);	//Speed Limit from end to source, 0.1 km/h
-            ofile << "\t" << poFeature->GetFieldAsString(6);	//Toll fee
-            ofile << "\t" << poFeature->GetFieldAsString(27);	//Lane Number
-            ofile << "\t" << poFeature->GetFieldAsString(4);	//Width
-            ofile << "\t" << poFeature->GetFieldAsString(2);	//KindNumber
-            ofile << "\t" << poFeature->GetFieldAsString(3);	//Kind
+    bool ifDumpFile=!dumpFile.empty();
+    ofstream ofile;
+    if(ifDumpFile){
+        ofile.open(dumpFile);
+        if(!ofile.is_open()){
+            log << "Open file failed!" << dumpFile << endl;
+            GDALClose(poDS);
+            return false;
+        }
+        ofile << "ID\tlatitudinal\tlongitudinal\tlight_flag\tnode_lid.size\tnode_lid\tCrossFlag\tCross_lid.size\tCross_lid\tMainNodeid\tsubnodeid\tsubnodeid2\tadjoin_nid"<<endl;
+        ofile << poLayer->GetFeatureCount()<<endl;//feature number
+    }
 
-            ofile<<endl;
+    nodes.clear();
+    nodes.reserve(max<long long int>(poLayer->GetFeatureCount(),0));
+    int noPointNum=0;//number of nodes without point geometry
+    auto process=[&](auto& row){
+        nodes.emplace_back();
+        bool ifPoint;
+        if(!ReadNode(row,nodes.back(),ifPoint)){
+            log<<"Wrong syntax! node "<<row.String(1)<<endl;
+            return false;
+        }
+        if(!ifPoint) noPointNum++;
+        if(ifDumpFile) WriteNodeLine(ofile,row);
+        return true;
+    };
+    bool ifArrow=false, ifSuccess=true;
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,6,0)
+    ifArrow=ReadLayerArrow(poLayer, ifDumpFile?nodeFields:nodeGraphFields, true, process, ifSuccess, log);//column batches
+#endif
+    if(!ifArrow){//feature by feature
+        while(ifSuccess && (poFeature = poLayer->GetNextFeature()) != NULL)
+        {
+            FeatureRow row{poFeature};
+            ifSuccess=process(row);
             OGRFeature::DestroyFeature(poFeature);
         }
-        GDALClose(poFeature);
+    }
+    GDALClose(poDS);
+    if(!ifSuccess){
+        return false;
+    }
+    if(noPointNum>0){
+        log<<"Nodes without point geometry: "<<noPointNum<<endl;
+    }
+    if(ifDumpFile){
         ofile.close();
-        cout<<"Write Done.\n"<<endl;
+        log<<"Write "<<dumpFile<<" done."<<endl;
     }
-    else{
-        cout<<"File "<<outputFile<<" already exist."<<endl;
-        ifile.close();
+    log<<"Read "<<nodes.size()<<" nodes.\n"<<endl;
+    return true;
+}
+
+//function of reading the fields of one feature of polyline.shp used by the graph, return false if an integer field is malformed
+template <class Row>
+bool ReadEdge(Row& row, RoadEdge& edge){
+    long long int ID1, ID2, direction, speedClass;
+    if(!ToInteger(row.String(1),edge.ID) || !ToInteger(row.String(9),ID1) || !ToInteger(row.String(10),ID2)
+        || !ToInteger(row.String(5),direction) || !ToInteger(row.String(24),speedClass)){
+        return false;
     }
+    edge.ID1=ID1, edge.ID2=ID2;
+    edge.direction=direction, edge.speedClass=speedClass;
+    edge.length=row.Double(12) * 1000;//meter
+    return true;
+}
 
+//function of reading the fields of one feature of point.shp used by the graph, return false if an ID field is malformed, ifPoint is false if it has no point geometry
+template <class Row>
+bool ReadNode(Row& row, RoadNode& node, bool& ifPoint){
+    long long int ID, adjoinID=0;
+    if(!ToInteger(row.String(1),ID)) return false;
+    string_view adjoin=row.String(11);
+    if(!adjoin.empty() && !ToInteger(adjoin,adjoinID)) return false;//empty if there is no adjoining dataset
+    node.ID=ID, node.adjoinID=adjoinID;
+    ifPoint=row.Point(node.lon,node.lat);
+    return true;
 }
-// function of extracting node information from point.shp
-void NodePointProcess(char * sourceFile, char * layerName, string outputFile){
-    ifstream ifile(outputFile);
-    if(!ifile.is_open()){//not open
-        ifile.close();
-        GDALDataset *poDS;  //Data source
-//    string sourcePath="/Users/zhouxj/Documents/1-Research/Datasets/NavInfo/map/fujian/road/";
-//    poDS = (GDALDataset*) GDALOpenEx("./beijing/road/Nbeijing_point.shp", GDAL_OF_VECTOR, NULL, NULL, NULL);
-        poDS = (GDALDataset*) GDALOpenEx(sourceFile, GDAL_OF_VECTOR, NULL, NULL, NULL);
-//    poDS = (GDALDataset*) GDALOpenEx("/Users/zhouxj/Documents/1-Research/Datasets/NavInfo/map/fujian/road/Nfujian_point.shp", GDAL_OF_VECTOR, NULL, NULL, NULL);
-
-        if(poDS == NULL)
-        {
-            cout << "Open shp file failed!" << endl;
-            exit(1);
-        }
-        cout << "Data source open success!" << endl;
 
-        int layerNum = poDS->GetLayerCount();   //a dataset may have many layers
-        cout << "Layer number:" << layerNum << endl;
+//function of parsing a field text as a decimal integer, return false if it is empty or not a whole integer
+bool ToInteger(string_view s, long long int& value){
+    value=0;
+    auto res=from_chars(s.data(), s.data()+s.size(), value);
+    return !s.empty() && res.ec==errc() && res.ptr==s.data()+s.size();
+}
 
-        OGRLayer *poLayer;
-//    poLayer = poDS->GetLayerByName("Nfujian_point");
-        poLayer = poDS->GetLayerByName(layerName);
+//function of writing one feature of polyline.shp as a line of the edge file
+template <class Row>
+void WriteEdgeLine(ofstream& ofile, Row& row){
+    ofile << row.String(1);			//ID
 
-        //feature is a geometry and a set of attributes
-        OGRFeature *poFeature;
-        poLayer->ResetReading();    //Start at the beginning of the layer
-        cout << "Feature number:" << poLayer->GetFeatureCount() << endl;
+    ofile << "\t"<< row.String(5);	//Direction
+    auto temp=row.Double(12) * 1000;
+    ofile << "\t"<< (int)temp;	                    //Length
 
-        auto layerDefn=poLayer->GetLayerDefn();
-        for(int i=0;i<layerDefn->GetFieldCount();++i){
-            cout<<layerDefn->GetFieldDefn(i)->GetNameRef()<<" ";
-        }
-        cout<<endl;
+    ofile << "\t" << row.String(9);    //Source ID
+    ofile << "\t" << row.String(10);   //End ID
 
-        stringstream ss;
-        map<string, pair<double, double> > mip;
-        map<string, pair<double, double> >::iterator imip;
+    ofile << "\t" << row.String(24);	//Speed Limit class, 1: >130 km/h; 2: (100 km/h, 130 km/h]; 3: (90 km/h, 100 km/h]; 4: (70 km/h, 90 km/h]; 5: (50 km/h, 70 km/h]; 6: (30 km/h, 50 km/h]; 7: [11 km/h, 30 km/h]; 8: <11 km/h
+    ofile << "\t" << row.String(33);	//Speed Limit from source to end, 0.1 km/s
+    ofile << "\t" << row.String(34);	//Speed Limit from end to source, 0.1 km/h
+    ofile << "\t" << row.String(6);	//Toll fee
+    ofile << "\t" << row.String(27);	//Lane Number
+    ofile << "\t" << row.String(4);	//Width
+    ofile << "\t" << row.String(2);	//KindNumber
+    ofile << "\t" << row.String(3);	//Kind
 
-        ofstream ofile(outputFile);
-        if(!ofile.is_open()){
-            cout << "Open file failed!" << outputFile << endl;
-            exit(1);
-        }
+    ofile<<endl;
+}
 
-        ofile << "ID\tlatitudinal\tlongitudinal\tlight_flag\tnode_lid.size\tnode_lid\tCrossFlag\tCross_lid.size\tCross_lid\tMainNodeid\tsubnodeid\tsubnodeid2\tadjoin_nid"<<endl;
-        ofile << poLayer->GetFeatureCount()<<endl;//feature number
+//function of writing one feature of point.shp as a line of the node file
+template <class Row>
+void WriteNodeLine(ofstream& ofile, Row& row){
+    int	crossFlag;
+    string stmp, stmp2;
+    vector<string> vs;
+    vector<string>::iterator ivs;
+    double x, y;
 
-        string id;
-        int	crossFlag;
-        string stmp, stmp2;
-        vector<string> vs;
-        vector<string>::iterator ivs;
-        while((poFeature = poLayer->GetNextFeature()) != NULL)
-        {
-            //Defn contains the definition of all the fields
-            OGRFeatureDefn *poFDefn = poLayer->GetLayerDefn();
-//        for(iField = 0; iField < poFDefn->GetFieldCount(); iField++)
-            //       {
-//        OGRFieldDefn * poFieldDefn = poFDefn->GetFieldDefn(iField);
-            id = poFeature->GetFieldAsString(1);
-
-            ofile << id;//ID
-
-            OGRGeometry *poGeometry;
-            poGeometry = poFeature->GetGeometryRef();
-//        cout << "Geometry Type:" << poGeometry->getGeometryType() << endl;
-            if(poGeometry != NULL && wkbFlatten(poGeometry->getGeometryType()) == wkbMultiPoint)
-            {
-                OGRMultiPoint *poMultiPoint = (OGRMultiPoint*)poGeometry;
-                //          cout << "Number in the MultiPoint:" << poMultiPoint->getNumGeometries() << endl;
+    ofile << row.String(1);//ID
 
-                OGRGeometry *pG;
-                pG = poMultiPoint->getGeometryRef(0);
-                OGRPoint *pP = (OGRPoint*)pG;
-                ofile << "\t" << pP->getX()<< "\t" << pP->getY();//longi,lati
-//            pP->flattenTo2D();
-                //           cout <<  setprecision(15) << pP->getY() << ", " << pP->getX() << endl;
-                //           mip[id] = make_pair(pP->getY(), pP->getX());
+    if(row.Point(x,y))
+    {
+        ofile << "\t" << x<< "\t" << y;//longi,lati
+    }//the nodes without point geometry are counted and reported once by NodePointProcess
 
-            }
-            else
-                cout << "No Point Geometry" << endl;
-
-            ofile << "\t" << poFeature->GetFieldAsString(5);//light_flag, 0: no light, 1: with light
-
-            stmp = poFeature->GetFieldAsString(12);
-            vs = split(stmp, "|");
-            ofile << "\t" << vs.size();
-            for(ivs = vs.begin(); ivs != vs.end(); ivs++)
-                ofile << "\t" << *ivs;//node_lid
-            vs.clear();
-/*            if(poFieldDefn->GetType() == OFTInteger)
-                cout << poFeature->GetFieldAsInteger(iField) << ", ";
-            else if(poFieldDefn->GetType() == OFTInteger64)
-                cout << poFeature->GetFieldAsInteger64(iField) << ", ";
-            else if(poFieldDefn->GetType() == OFTReal)
-                cout << setprecision(15) << poFeature->GetFieldAsDouble(iField) << ", ";
-            else if(poFieldDefn->GetType() == OFTString)
-                cout << poFeature->GetFieldAsString(iField) << ", ";
-            else
-                cout << poFeature->GetFieldAsString(iField) << ", ";*/
-//        }
+    ofile << "\t" << row.String(5);//light_flag, 0: no light, 1: with light
 
+    stmp = row.String(12);
+    vs = split(stmp, "|");
+    ofile << "\t" << vs.size();
+    for(ivs = vs.begin(); ivs != vs.end(); ivs++)
+        ofile << "\t" << *ivs;//node_lid
+    vs.clear();
 
+    crossFlag = row.Integer(4);//Cross flag
+    if(crossFlag == 0)//if not an intersection
+    {
+        ofile << "\t" << crossFlag << "\t" << 0 << "\t" << 0 << "\t" << 0;
+    }
+    else if(crossFlag == 1)
+    {
+        ofile << "\t" << crossFlag << "\t" << 0 << "\t" << row.Integer(7) << "\t" << 0;
+    }
+    else if(crossFlag == 2)
+    {
+        stmp = row.String(6);
+        vs = split(stmp, "|");
+        ofile << "\t" << crossFlag << "\t" << vs.size();
+        for(ivs = vs.begin(); ivs != vs.end(); ivs++)
+            ofile << "\t" << *ivs;
+        vs.clear();
+        ofile << "\t" << row.Integer(7) << "\t" << 0;
+    }
+    else if(crossFlag == 3)
+    {
+        stmp = row.String(6);
+        vs = split(stmp, "|");
+        ofile << "\t" << crossFlag << "\t" << vs.size();
+        for(ivs = vs.begin(); ivs != vs.end(); ivs++)
+            ofile << "\t" << *ivs;
+        vs.clear();
 
-            crossFlag = poFeature->GetFieldAsInteger(4);//Cross flag
-            if(crossFlag == 0)//if not an intersection
-            {
-                ofile << "\t" << crossFlag << "\t" << 0 << "\t" << 0 << "\t" << 0;
-            }
-            else if(crossFlag == 1)
-            {
-                ofile << "\t" << crossFlag << "\t" << 0 << "\t" << poFeature->GetFieldAsInteger(7) << "\t" << 0;
-            }
-            else if(crossFlag == 2)
-            {
-                stmp = poFeature->GetFieldAsString(6);
-                vs = split(stmp, "|");
-                ofile << "\t" << crossFlag << "\t" << vs.size();
-                for(ivs = vs.begin(); ivs != vs.end(); ivs++)
-                    ofile << "\t" << *ivs;
-                vs.clear();
-                ofile << "\t" << poFeature->GetFieldAsInteger(7) << "\t" << 0;
-            }
-            else if(crossFlag == 3)
-            {
-                stmp = poFeature->GetFieldAsString(6);
-                vs = split(stmp, "|");
-                ofile << "\t" << crossFlag << "\t" << vs.size();
-                for(ivs = vs.begin(); ivs != vs.end(); ivs++)
-                    ofile << "\t" << *ivs;
-                vs.clear();
-
-                ofile << "\t" << poFeature->GetFieldAsInteger(7);
-                stmp = poFeature->GetFieldAsString(8);
-                stmp2 = poFeature->GetFieldAsString(9);
-                if(stmp2 != "")
-                    stmp += "|" + stmp2;
-                vs = split(stmp, "|");
-                ofile << "\t" << vs.size();
-                for(ivs = vs.begin(); ivs != vs.end(); ivs++)
-                    ofile << "\t" << *ivs;
-                vs.clear();
-            }
+        ofile << "\t" << row.Integer(7);
+        stmp = row.String(8);
+        stmp2 = row.String(9);
+        if(stmp2 != "")
+            stmp += "|" + stmp2;
+        vs = split(stmp, "|");
+        ofile << "\t" << vs.size();
+        for(ivs = vs.begin(); ivs != vs.end(); ivs++)
+            ofile << "\t" << *ivs;
+        vs.clear();
+    }
 
-            ofile << "\t" << poFeature->GetFieldAsString(11);
+    ofile << "\t" << row.String(11);
 
+    ofile << endl;
+}
 
-            ofile << endl;
-            OGRFeature::DestroyFeature(poFeature);
-        }
+bool FeatureRow::Point(double& x, double& y){
+    OGRGeometry *poGeometry = poFeature->GetGeometryRef();
+    if(poGeometry != NULL && wkbFlatten(poGeometry->getGeometryType()) == wkbMultiPoint)
+    {
+        OGRMultiPoint *poMultiPoint = (OGRMultiPoint*)poGeometry;
+        OGRPoint *pP = (OGRPoint*)poMultiPoint->getGeometryRef(0);
+        x=pP->getX(), y=pP->getY();
+        return true;
+    }
+    return false;
+}
 
-/*	cout << "Writing nodes" << endl;
-    for(imip = mip.begin(); imip != mip.end(); imip++)
-        ofile << setprecision(15) << (*imip).first << "\t" << (*imip).second.first << "\t" << (*imip).second.second << endl;*/
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,6,0)
+bool ArrowColumn::IsNull(int64_t r) const{
+    if(array->null_count==0 || array->buffers[0]==nullptr) return false;
+    int64_t j=offset+r;
+    return (((const uint8_t*)array->buffers[0])[j>>3] >> (j&7) & 1)==0;
+}
 
-        GDALClose(poFeature);
-        ofile.close();
-        cout<<"Write Done.\n"<<endl;
+string_view ArrowColumn::String(int64_t r){
+    if(IsNull(r)) return string_view();
+    int64_t j=offset+r;
+    switch(format){
+        case 'u': case 'z': {
+            const int32_t* offsets=(const int32_t*)array->buffers[1];
+            return string_view((const char*)array->buffers[2]+offsets[j], offsets[j+1]-offsets[j]);
+        }
+        case 'U': case 'Z': {
+            const int64_t* offsets=(const int64_t*)array->buffers[1];
+            return string_view((const char*)array->buffers[2]+offsets[j], offsets[j+1]-offsets[j]);
+        }
+        case 'f': case 'g':
+            if(width!=0) snprintf(buffer, sizeof(buffer), "%.*f", precision, Double(r));
+            else snprintf(buffer, sizeof(buffer), "%.15g", Double(r));
+            return string_view(buffer);
+        default:
+            snprintf(buffer, sizeof(buffer), "%lld", Integer(r));
+            return string_view(buffer);
     }
-    else{
-        cout<<"File "<<outputFile<<" already exist."<<endl;
-        ifile.close();
+}
+
+double ArrowColumn::Double(int64_t r){
+    if(IsNull(r)) return 0;
+    int64_t j=offset+r;
+    switch(format){
+        case 'f': return ((const float*)array->buffers[1])[j];
+        case 'g': return ((const double*)array->buffers[1])[j];
+        case 'u': case 'U': return atof(string(String(r)).c_str());
+        default: return Integer(r);
+    }
+}
+
+long long ArrowColumn::Integer(int64_t r){
+    if(IsNull(r)) return 0;
+    int64_t j=offset+r;
+    switch(format){
+        case 'c': return ((const int8_t*)array->buffers[1])[j];
+        case 's': return ((const int16_t*)array->buffers[1])[j];
+        case 'i': return ((const int32_t*)array->buffers[1])[j];
+        case 'l': return ((const int64_t*)array->buffers[1])[j];
+        case 'f': case 'g': return (long long)Double(r);
+        case 'u': case 'U': return atoll(string(String(r)).c_str());
+        default: return 0;
     }
+}
+
+bool ArrowRow::Point(double& x, double& y){
+    string_view wkb=geometry.String(r);
+    if(wkb.size()<9) return false;
+    const uint16_t one=1;
+    const bool ifLittle=*(const uint8_t*)&one==1;//whether this machine is little-endian (WKB byte order 1)
+    bool swap=(wkb[0]==1)!=ifLittle;
+    auto Read=[&](size_t pos, void* value, size_t size){
+        memcpy(value, wkb.data()+pos, size);
+        if(swap) reverse((char*)value, (char*)value+size);
+    };
+    uint32_t type, num;
+    Read(1, &type, 4);
+    Read(5, &num, 4);
+    if((type&0xffff)%1000 != wkbMultiPoint || num==0 || wkb.size()<9+21) return false;
+    swap=(wkb[9]==1)!=ifLittle;//byte order of the first point
+    Read(14, &x, 8);
+    Read(22, &y, 8);
+    return true;
+}
 
+//function of reading the fields (and the WKB geometry) of a layer in column batches through the Arrow array stream, write(row) is called for every feature in order until it returns false
+//return false without reading any feature if the stream is not available or a column has an unsupported type, then the caller reads feature by feature
+//ifSuccess is set to false if a batch cannot be read or write(row) returns false
+template <class Write>
+bool ReadLayerArrow(OGRLayer* poLayer, const vector<int>& fields, bool ifGeometry, Write write, bool& ifSuccess, ostream& log){
+    OGRFeatureDefn* poFDefn=poLayer->GetLayerDefn();
+    vector<const char*> ignored;//only the columns of fields are materialized
+    for(int i=0;i<poFDefn->GetFieldCount();++i){
+        if(find(fields.begin(),fields.end(),i)==fields.end()) ignored.push_back(poFDefn->GetFieldDefn(i)->GetNameRef());
+    }
+    if(!ifGeometry) ignored.push_back("OGR_GEOMETRY");
+    ignored.push_back(nullptr);
+    poLayer->SetIgnoredFields(ignored.data());
+
+    const char* options[]={"INCLUDE_FID=NO", "MAX_FEATURES_IN_BATCH=65536", nullptr};
+    struct ArrowArrayStream stream;
+    struct ArrowSchema schema;
+    bool ifValid=false;
+    if(poLayer->GetArrowStream(&stream, options)){
+        if(stream.get_schema(&stream, &schema)==0){
+            ifValid=true;
+            ArrowRow row;
+            row.columns.assign(poFDefn->GetFieldCount(),ArrowColumn());
+            vector<int> childField(schema.n_children,-1);//field index of each child, -2 for the geometry
+            string geometryName=poLayer->GetGeometryColumn();
+            if(geometryName.empty()) geometryName="wkb_geometry";
+            for(int c=0;c<schema.n_children;++c){
+                string name=schema.children[c]->name;
+                char format=schema.children[c]->format[0];
+                bool ifSupported=schema.children[c]->format[1]=='\0' && strchr("uUzZcsilfg",format)!=nullptr;
+                int i=poFDefn->GetFieldIndex(name.c_str());
+                if(i>=0 && find(fields.begin(),fields.end(),i)!=fields.end()){
+                    if(!ifSupported) ifValid=false;
+                    childField[c]=i;
+                    row.columns[i].format=format;
+                    row.columns[i].width=poFDefn->GetFieldDefn(i)->GetWidth();
+                    row.columns[i].precision=poFDefn->GetFieldDefn(i)->GetPrecision();
+                }else if(ifGeometry && name==geometryName){
+                    if(format!='z' && format!='Z') ifValid=false;
+                    childField[c]=-2;
+                    row.geometry.format=format;
+                }
+            }
+            for(int i: fields){
+                if(row.columns[i].format==0) ifValid=false;
+            }
+            if(ifGeometry && row.geometry.format==0) ifValid=false;
+
+            struct ArrowArray batch;
+            while(ifValid && ifSuccess){
+                if(stream.get_next(&stream, &batch)!=0){
+                    log<<"Read Arrow batch failed! "<<stream.get_last_error(&stream)<<endl;
+                    ifSuccess=false;
+                    break;
+                }
+                if(batch.release==nullptr) break;//end of stream
+                for(int c=0;c<batch.n_children;++c){
+                    if(childField[c]==-1) continue;
+                    ArrowColumn& column= childField[c]==-2? row.geometry: row.columns[childField[c]];
+                    column.array=batch.children[c];
+                    column.offset=batch.offset+batch.children[c]->offset;
+                }
+                for(row.r=0;row.r<batch.length && ifSuccess;++row.r){
+                    ifSuccess=write(row);
+                }
+                batch.release(&batch);
+            }
+            schema.release(&schema);
+        }
+        stream.release(&stream);
+    }
+    poLayer->SetIgnoredFields(nullptr);
+    if(!ifValid){
+        log<<"Arrow stream is not available, read feature by feature."<<endl;
+        poLayer->ResetReading();
+    }
+    return ifValid;
 }
+#endif
 
 void RoadNetworkPreprocess(string graph_path){
-    vector<unordered_map<int,int>> NeighborMap; //adjacency list of original graph, map version
-    vector<unordered_map<int,int>> NeighborMap2; //adjacency list of original graph, map version
+    CSRGraph graph; //original graph with both the travel time and distance of each edge
 
     string gFile=graph_path+"_Time.gr";
     string coFile=graph_path+"_Coordinate.co";
@@ -907,8 +1229,8 @@ void RoadNetworkPreprocess(string graph_path){
     boost::split(vs,line,boost::is_any_of(" "));
     node_num=stoi(vs[0]), edge_num=stoi(vs[1]);
     cout<<"Node number: "<<node_num<<" , edge number: "<<edge_num<<endl;
-    NeighborMap.assign(node_num,unordered_map<int,int>());
-    unsigned long long int edgeNum=0;
+    vector<CSREdge> edges;
+    edges.reserve(2*edge_num);
     while(getline(inGraph,line)){
         if(line.empty()) continue;
         istringstream iss(line);
@@ -918,19 +1240,18 @@ void RoadNetworkPreprocess(string graph_path){
         }
 
         if(ID1>=0 && ID1<node_num && ID2>=0 && ID2<node_num && weight>0){
-//            NeighborMap[ID1].insert({ID2,weight});
-            if(NeighborMap[ID1].find(ID2)==NeighborMap[ID1].end()){//if not found
-                NeighborMap[ID1].insert({ID2,weight});
-                NeighborMap[ID2].insert({ID1,weight});
-                edgeNum+=2;
-            }
+            edges.push_back({ID1,ID2,0,weight});
+            edges.push_back({ID2,ID1,0,weight});
         }else{
             cout<<"Graph data is wrong! "<<ID1<<" "<<ID2<<" "<<weight<<endl;
         }
     }
     inGraph.close();
+    graph.Build(node_num,edges,true,true,threadNum);//the distances are filled from the distance graph
+    vector<CSREdge>().swap(edges);
+    graph.RemoveDuplicates();//the first edge between two vertices decides their travel time in both directions
     cout<<"Finished."<<endl;
-    cout<<"New edge number: "<<edgeNum<<endl;
+    cout<<"New edge number: "<<graph.EdgeNum()<<endl;
 
     gFile=graph_path+"_Distance.gr";
     ifstream inGraph2(gFile, ios::in);
@@ -945,8 +1266,11 @@ void RoadNetworkPreprocess(string graph_path){
     boost::split(vs,line,boost::is_any_of(" "));
     node_num=stoi(vs[0]), edge_num=stoi(vs[1]);
     cout<<"Node number: "<<node_num<<" , edge number: "<<edge_num<<endl;
-    NeighborMap2.assign(node_num,unordered_map<int,int>());
-    edgeNum=0;
+    if(node_num!=graph.nodeNum){
+        cout<<"Inconsistent node number between the distance graph and time graph. "<<graph.nodeNum<<" "<<node_num<<endl; exit(1);
+    }
+    unsigned long long int edgeNum=0;
+    vector<pair<int,int>> extraEdges;//edges of the distance graph that are not in the time graph, checked against the largest connected component
     while(getline(inGraph2,line)){
         if(line.empty()) continue;
         istringstream iss(line);
@@ -956,11 +1280,13 @@ void RoadNetworkPreprocess(string graph_path){
         }
 
         if(ID1>=0 && ID1<node_num && ID2>=0 && ID2<node_num && weight>0){
-//            NeighborMap[ID1].insert({ID2,weight});
-            if(NeighborMap2[ID1].find(ID2)==NeighborMap2[ID1].end()){//if not found
-                NeighborMap2[ID1].insert({ID2,weight});
-                NeighborMap2[ID2].insert({ID1,weight});
-                edgeNum+=2;
+            long long int pos=graph.Find(ID1,ID2);
+            if(pos==-1){
+                extraEdges.emplace_back(ID1,ID2);
+            }else if(graph.distance[pos]==0){//the first edge between two vertices decides their distance in both directions
+                graph.distance[pos]=weight;
+                graph.distance[graph.Find(ID2,ID1)]=weight;
+                edgeNum+=(ID1==ID2?1:2);
             }
         }else{
             cout<<"Graph data is wrong! "<<ID1<<" "<<ID2<<" "<<weight<<endl;
@@ -1013,7 +1339,7 @@ void RoadNetworkPreprocess(string graph_path){
     }
     set<int> verticesFinal;
     pair<int, unsigned long long int> LCC;
-    LCC = DFS_CC(NeighborMap,vertices,verticesFinal,node_num);
+    LCC = DFS_CC(graph,vertices,verticesFinal,node_num);
     map<int,int> IDMap;
     int ID=0;
     for(auto it=verticesFinal.begin();it!=verticesFinal.end();++it){
@@ -1023,6 +1349,20 @@ void RoadNetworkPreprocess(string graph_path){
     if(IDMap.size()!=LCC.first){
         cout<<"Wrong! Inconsistent! "<<IDMap.size()<<" "<<LCC.first<<endl; exit(1);
     }
+    //the vertices of the largest connected component should have the same neighbors in the distance graph and time graph
+    for(auto it=verticesFinal.begin();it!=verticesFinal.end();++it){
+        ID1=*it;
+        for(auto i=graph.offsets[ID1];i<graph.offsets[ID1+1];++i){
+            if(graph.distance[i]==0){
+                cout<<"Inconsistent neighbors between the distance graph and time graph. "<<ID1<<" "<<graph.adjacency[i]<<endl; exit(1);
+            }
+        }
+    }
+    for(auto& edge: extraEdges){
+        if(verticesFinal.find(edge.first)!=verticesFinal.end() || verticesFinal.find(edge.second)!=verticesFinal.end()){
+            cout<<"Inconsistent neighbors between the distance graph and time graph. "<<edge.first<<" "<<edge.second<<endl; exit(1);
+        }
+    }
     /// Write ID map
     ofstream OF(graph_path+".IDMap", ios::out);
     if(!OF.is_open()){
@@ -1045,8 +1385,8 @@ void RoadNetworkPreprocess(string graph_path){
 
     for(auto it=verticesFinal.begin();it!=verticesFinal.end();++it){
         ID1=*it;
-        for(auto it2=NeighborMap[ID1].begin();it2!=NeighborMap[ID1].end();++it2){
-            ID2=it2->first, weight=it2->second;
+        for(auto i=graph.offsets[ID1];i<graph.offsets[ID1+1];++i){
+            ID2=graph.adjacency[i], weight=graph.time[i];
             outGraph<<IDMap[ID1]<<" "<<IDMap[ID2]<<" "<<weight<<endl;
         }
     }
@@ -1063,11 +1403,8 @@ void RoadNetworkPreprocess(string graph_path){
 
     for(auto it=verticesFinal.begin();it!=verticesFinal.end();++it){
         ID1=*it;
-        if(NeighborMap[ID1].size()!=NeighborMap2[ID1].size()){
-            cout<<"Inconsistent neighbors between the distance graph and time graph. "<<ID1<<" "<<NeighborMap[ID1].size()<<" "<<NeighborMap2[ID1].size()<<endl; exit(1);
-        }
-        for(auto it2=NeighborMap2[ID1].begin();it2!=NeighborMap2[ID1].end();++it2){
-            ID2=it2->first, weight=it2->second;
+        for(auto i=graph.offsets[ID1];i<graph.offsets[ID1+1];++i){
+            ID2=graph.adjacency[i], weight=graph.distance[i];
             outGraph2<<IDMap[ID1]<<" "<<IDMap[ID2]<<" "<<weight<<endl;
         }
     }
@@ -1112,8 +1449,7 @@ void RoadNetworkPreprocess(string graph_path){
     cout<<"Finished."<<endl;
 }
 
-template <class T>
-pair<int, unsigned long long int> DFS_CC(T & Edges, unordered_set<int> & set_A, set<int> & set_LCC, int nodenum) {
+pair<int, unsigned long long int> DFS_CC(CSRGraph & Edges, unordered_set<int> & set_A, set<int> & set_LCC, int nodenum) {
     /// DFS for connected component
     stack<int> stack_A;
 //    set<int> set_A;//nodes waiting for visited
@@ -1141,8 +1477,8 @@ pair<int, unsigned long long int> DFS_CC(T & Edges, unordered_set<int> & set_A,
         while (!stack_A.empty()) {
             item_id = stack_A.top();
             stack_A.pop();
-            for (auto it = Edges[item_id].begin(); it != Edges[item_id].end(); ++it) {
-                temp_id = it->first;
+            for (auto i = Edges.offsets[item_id]; i < Edges.offsets[item_id+1]; ++i) {
+                temp_id = Edges.adjacency[i];
                 temp_num += 1;
                 if (!flag_visited[temp_id]) {//if not visited
                     stack_A.push(temp_id);
@@ -1288,3 +1624,50 @@ vector<string> split(const string &s, const string &seperator)
 			  
 	return result;
 }
+
+int* IDHashMap::Find(unsigned long long int key){
+    for(size_t i=Slot(key);values[i]!=-1;i=(i+1)&(keys.size()-1)){
+        if(keys[i]==key) return &values[i];
+    }
+    return nullptr;
+}
+
+int& IDHashMap::operator[](unsigned long long int key){
+    if(2*(num+1)>keys.size()) Rehash(2*keys.size());//keep the load factor at most 0.5
+    size_t i=Slot(key);
+    for(;values[i]!=-1;i=(i+1)&(keys.size()-1)){
+        if(keys[i]==key) return values[i];
+    }
+    keys[i]=key; values[i]=0;
+    num++;
+    return values[i];
+}
+
+void IDHashMap::Rehash(size_t capacity){
+    size_t newSize=16;
+    while(newSize<capacity) newSize<<=1;
+    vector<unsigned long long int> oldKeys(newSize);
+    vector<int> oldValues(newSize,-1);
+    oldKeys.swap(keys); oldValues.swap(values);
+    for(size_t i=0;i<oldKeys.size();++i){
+        if(oldValues[i]==-1) continue;
+        size_t j=Slot(oldKeys[i]);
+        while(values[j]!=-1) j=(j+1)&(keys.size()-1);
+        keys[j]=oldKeys[i]; values[j]=oldValues[i];
+    }
+}
+
+vector<pair<unsigned long long int,int>> IDHashMap::Sorted() const{
+    vector<pair<unsigned long long int,int>> entries;
+    entries.reserve(num);
+    for(size_t i=0;i<keys.size();++i){
+        if(values[i]!=-1) entries.emplace_back(keys[i],values[i]);
+    }
+    sort(entries.begin(),entries.end());
+    return entries;
+}
+
+//function of packing the grid cell (x,y) into one key, x and y fit in 32 bits for snapTolerance >= 1e-7
+unsigned long long int GridCell(long long int x, long long int y){
+    return ((unsigned long long int)(uint32_t)x<<32) | (uint32_t)y;
+}
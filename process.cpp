@@ -16,29 +16,30 @@
 #include <string>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/classification.hpp>
+#include "CSRGraph.h"
 
 using namespace std;
 
 vector<string> split(const string &s, const string &seperator);
 void ProcessPartitionedGraph(string sourcePath, string dataset, string graphFile, string coordFile, int& node_num, int& edge_num, vector<pair<double,double>>& Coord, int pNum);
-void ProcessWholeGraph(string sourcePath, string dataset, string graphFile, string coordFile, int& node_num, int& edge_num, vector<vector<pair<int,int>>>& Neighbors, vector<pair<double,double>>& Coord);
+void ProcessWholeGraph(string sourcePath, string dataset, string graphFile, string coordFile, int& node_num, int& edge_num, CSRGraph& Neighbors, vector<pair<double,double>>& Coord);
 void ReadGraphPartitions(string filename, int& node_num, int& edge_num, int& partiNum);
-void ReadGraph(string& filename, int& node_num, int& edge_num, vector<vector<pair<int,int>>>& Neighbors);
+void ReadGraph(string& filename, int& node_num, int& edge_num, CSRGraph& Neighbors);
 void ReadCoordinate(string& filename, int& node_num, vector<pair<double,double>>& Coord);
-void WriteEdgeOverlayCSVFile(string filename, vector<vector<pair<int,int>>>& Neighbors, vector<pair<double,double>>& Coord);
-void WriteEdgePartiCSVFile(int pid, string filename, vector<vector<pair<int,int>>>& Neighbors, vector<pair<double,double>>& Coord);
-void WriteNodeOverlayCSVFile(string filename, vector<vector<pair<int,int>>>& Neighbors, vector<pair<double,double>>& Coord);
-void WriteEdgeCSVFile(string filename, vector<vector<pair<int,int>>>& Neighbors, vector<pair<double,double>>& Coord);
-void WriteNodeCSVFile(string filename, vector<vector<pair<int,int>>>& Neighbors, vector<pair<double,double>>& Coord);
+void WriteEdgeOverlayCSVFile(string filename, CSRGraph& Neighbors, vector<pair<double,double>>& Coord);
+void WriteEdgePartiCSVFile(int pid, string filename, CSRGraph& Neighbors, vector<pair<double,double>>& Coord);
+void WriteNodeOverlayCSVFile(string filename, CSRGraph& Neighbors, vector<pair<double,double>>& Coord);
+void WriteEdgeCSVFile(string filename, CSRGraph& Neighbors, vector<pair<double,double>>& Coord);
+void WriteNodeCSVFile(string filename, CSRGraph& Neighbors, vector<pair<double,double>>& Coord);
 void QueryToNodeCSV(string graphFile, vector<pair<double,double>>& Coord, string dayName, unsigned long long startT, unsigned long long endT);
 void UpdateToNodeCSV(string graphFile, vector<pair<double,double>>& Coord, string dayName, unsigned long long startT, unsigned long long endT);
 void StatisticCompute(string filename, unsigned long long startT, unsigned long long endT);
 bool ifNew=false;
 vector<vector<int>> PartiVertex;//<partition_number,<in-partition vertices>>, in increasing vertex order, higher-rank vertex first
 vector<vector<int>> BoundVertex;//boundary vertices of each partition
-vector<vector<pair<int,int>>> Neighbor;//original graph
-vector<vector<pair<int,int>>> NeighborsParti;//<node_number,<in-partition adjacency lists>>
-vector<vector<pair<int,int>>> NeighborsOverlay;//<node_number,<adjacency lists of overlay graph>>
+CSRGraph Neighbor;//original graph
+CSRGraph NeighborsParti;//in-partition edges
+CSRGraph NeighborsOverlay;//edges of overlay graph
 vector<pair<int,bool>> PartiTag;//<node_number,<partition_id,if_boundary>>, for PMHL
 
 int main(int argc, char** argv){
@@ -70,7 +71,7 @@ int main(int argc, char** argv){
 
 
     int node_num=0, edge_num=0;
-    vector<vector<pair<int,int>>> Neighbors;
+    CSRGraph Neighbors;
     vector<pair<double,double>> Coord;
 
     /// Show the whole road network
@@ -109,7 +110,7 @@ void ProcessPartitionedGraph(string sourcePath, string dataset, string graphFile
     WriteNodeOverlayCSVFile(sourcePath+dataset+"/partitions/"+dataset+"_NC_"+to_string(pNum)+"/"+dataset+"_node_"+to_string(partiNum)+"_overlay.csv", NeighborsOverlay, Coord);
 }
 
-void ProcessWholeGraph(string sourcePath, string dataset, string graphFile, string coordFile, int& node_num, int& edge_num, vector<vector<pair<int,int>>>& Neighbors, vector<pair<double,double>>& Coord){
+void ProcessWholeGraph(string sourcePath, string dataset, string graphFile, string coordFile, int& node_num, int& edge_num, CSRGraph& Neighbors, vector<pair<double,double>>& Coord){
     // Step 1: Read road networks
     ReadCoordinate(coordFile,node_num,Coord);
     // Read whole road network
@@ -142,9 +143,7 @@ void ReadGraphPartitions(string filename, int& node_num, int& edge_num, int& par
 //    vector<pair<int,bool>> PartiTag;//<node_number,<partition_id,if_boundary>>, for PMHL
 //    int partiNum=0;
 
-    Neighbor.assign(node_num,vector<pair<int,int>>());
-    NeighborsParti.assign(node_num, vector<pair<int,int>>());
-    NeighborsOverlay.assign(node_num,vector<pair<int,int>>());
+    vector<CSREdge> partiEdges, overlayEdges;//edges of the partitions and cut edges, the weight is travel time
     PartiTag.assign(node_num, make_pair(-1,false));
 
     ifstream IF1(filename+"/subgraph_vertex");
@@ -203,8 +202,7 @@ void ReadGraphPartitions(string filename, int& node_num, int& edge_num, int& par
         for(int i=0;i<edgenum0;i++){
             IF>>ID1>>ID2>>weight;
             if(ID1>=0 && ID1 <node_num && ID2>=0 && ID2 <node_num && weight>0){
-                NeighborsParti[ID1].emplace_back(ID2,weight);
-                Neighbor[ID1].emplace_back(ID2,weight);
+                partiEdges.push_back({ID1,ID2,0,weight});
 //                if(NeighborMap[ID1].find(ID2)==NeighborMap[ID1].end()){//not found
 //                    NeighborMap[ID1].insert(make_pair(ID2,weight));
 //                }else{
@@ -247,14 +245,18 @@ void ReadGraphPartitions(string filename, int& node_num, int& edge_num, int& par
                 BoundVertex[PartiTag[ID2].first].emplace_back(ID2);
             }
 
-            Neighbor[ID1].emplace_back(ID2,weight);
-            NeighborsOverlay[ID1].emplace_back(ID2,weight);
+            overlayEdges.push_back({ID1,ID2,0,weight});
         }else{
             cout<<"Wrong for cut_edge! "<<ID1<<" "<<ID2<<" "<<weight<<endl; exit(1);
         }
     }
 
 
+    NeighborsParti.Build(node_num,partiEdges,false,true);
+    NeighborsOverlay.Build(node_num,overlayEdges,false,true);
+    partiEdges.insert(partiEdges.end(),overlayEdges.begin(),overlayEdges.end());//the in-partition edges of a vertex come first
+    Neighbor.Build(node_num,partiEdges,false,true);
+
     vector<int> bNums;
 //    partiRootsV.assign(partiNum,vector<int>());//partition root vertex
     for(int pid=0;pid<partiNum;++pid){
@@ -264,10 +266,7 @@ void ReadGraphPartitions(string filename, int& node_num, int& edge_num, int& par
     cout<<"Overall boundary vertex number: "<<boundaryNum<<" ; Average boundary vertex number for each partition: "<<boundaryNum/partiNum<<" ; Maximum boundary number: "<<*max_element(bNums.begin(),bNums.end())<<endl;
 
     //further check the edges
-    unsigned long long calEdgeNum=0;
-    for(int i=0;i<Neighbor.size();i++){
-        calEdgeNum+=Neighbor[i].size();
-    }
+    unsigned long long calEdgeNum=Neighbor.EdgeNum();
     if(edge_num == 0){
         edge_num = calEdgeNum;
     }else{
@@ -566,7 +565,7 @@ void QueryToNodeCSV(string filename, vector<pair<double,double>>& Coord, string
 
 }
 
-void WriteEdgePartiCSVFile(int pid, string filename, vector<vector<pair<int,int>>>& Neighbors, vector<pair<double,double>>& Coord){
+void WriteEdgePartiCSVFile(int pid, string filename, CSRGraph& Neighbors, vector<pair<double,double>>& Coord){
     ifstream IF(filename);
     if(IF.is_open() && !ifNew){//already exists
         cout<<"File "<<filename<<" already exists."<<endl;
@@ -585,14 +584,14 @@ void WriteEdgePartiCSVFile(int pid, string filename, vector<vector<pair<int,int>
 
         OF<<"edgeID,x_lon,x_lat,y_lon,y_lat,weight"<<endl;
         unsigned long long int edgeID=0;
-        for(int i=0;i<Neighbors.size();++i){
+        for(int i=0;i<Neighbors.nodeNum;++i){
             ID1=i;
             if(PartiTag[ID1].first!=pid){
                 continue;
             }
-            for(int j=0;j<Neighbors[i].size();++j){
-                ID2=Neighbors[i][j].first;
-                weightT=Neighbors[i][j].second;
+            for(auto j=Neighbors.offsets[i];j<Neighbors.offsets[i+1];++j){
+                ID2=Neighbors.adjacency[j];
+                weightT=Neighbors.time[j];
                 OF<<edgeID<<","<<Coord[ID1].first<<","<<Coord[ID1].second<<","<<Coord[ID2].first<<","<<Coord[ID2].second<<","<<weightT<<endl;
                 edgeID++;
             }
@@ -604,7 +603,7 @@ void WriteEdgePartiCSVFile(int pid, string filename, vector<vector<pair<int,int>
 
 }
 
-void WriteEdgeOverlayCSVFile(string filename, vector<vector<pair<int,int>>>& Neighbors, vector<pair<double,double>>& Coord){
+void WriteEdgeOverlayCSVFile(string filename, CSRGraph& Neighbors, vector<pair<double,double>>& Coord){
     ifstream IF(filename);
     if(IF.is_open() && !ifNew){//already exists
         cout<<"File "<<filename<<" already exists."<<endl;
@@ -623,14 +622,14 @@ void WriteEdgeOverlayCSVFile(string filename, vector<vector<pair<int,int>>>& Nei
 
         OF<<"edgeID,x_lon,x_lat,y_lon,y_lat,weight"<<endl;
         unsigned long long int edgeID=0;
-        for(int i=0;i<Neighbors.size();++i){
+        for(int i=0;i<Neighbors.nodeNum;++i){
             ID1=i;
             if(!PartiTag[ID1].second){
                 continue;
             }
-            for(int j=0;j<Neighbors[i].size();++j){
-                ID2=Neighbors[i][j].first;
-                weightT=Neighbors[i][j].second;
+            for(auto j=Neighbors.offsets[i];j<Neighbors.offsets[i+1];++j){
+                ID2=Neighbors.adjacency[j];
+                weightT=Neighbors.time[j];
                 OF<<edgeID<<","<<Coord[ID1].first<<","<<Coord[ID1].second<<","<<Coord[ID2].first<<","<<Coord[ID2].second<<","<<weightT<<endl;
                 edgeID++;
             }
@@ -642,7 +641,7 @@ void WriteEdgeOverlayCSVFile(string filename, vector<vector<pair<int,int>>>& Nei
 
 }
 
-void WriteNodeOverlayCSVFile(string filename, vector<vector<pair<int,int>>>& Neighbors, vector<pair<double,double>>& Coord){
+void WriteNodeOverlayCSVFile(string filename, CSRGraph& Neighbors, vector<pair<double,double>>& Coord){
     ifstream IF(filename);
     if(IF.is_open()  && !ifNew){//already exists
         cout<<"File "<<filename<<" already exists."<<endl;
@@ -660,7 +659,7 @@ void WriteNodeOverlayCSVFile(string filename, vector<vector<pair<int,int>>>& Nei
         int ID1, ID2, weightT;
 
         OF << "nodeID,lon,lat" << endl;
-        for (int i = 0; i < Neighbors.size(); ++i) {
+        for (int i = 0; i < Neighbors.nodeNum; ++i) {
             ID1 = i;
             if(PartiTag[ID1].second){
                 OF << ID1 << "," << Coord[ID1].first << "," << Coord[ID1].second << endl;
@@ -672,7 +671,7 @@ void WriteNodeOverlayCSVFile(string filename, vector<vector<pair<int,int>>>& Nei
     }
 }
 
-void WriteEdgeCSVFile(string filename, vector<vector<pair<int,int>>>& Neighbors, vector<pair<double,double>>& Coord){
+void WriteEdgeCSVFile(string filename, CSRGraph& Neighbors, vector<pair<double,double>>& Coord){
     ifstream IF(filename);
     if(IF.is_open() && !ifNew){//already exists
         cout<<"File "<<filename<<" already exists."<<endl;
@@ -691,11 +690,11 @@ void WriteEdgeCSVFile(string filename, vector<vector<pair<int,int>>>& Neighbors,
 
         OF<<"edgeID,x_lon,x_lat,y_lon,y_lat,weight"<<endl;
         unsigned long long int edgeID=0;
-        for(int i=0;i<Neighbors.size();++i){
+        for(int i=0;i<Neighbors.nodeNum;++i){
             ID1=i;
-            for(int j=0;j<Neighbors[i].size();++j){
-                ID2=Neighbors[i][j].first;
-                weightT=Neighbors[i][j].second;
+            for(auto j=Neighbors.offsets[i];j<Neighbors.offsets[i+1];++j){
+                ID2=Neighbors.adjacency[j];
+                weightT=Neighbors.time[j];
                 OF<<edgeID<<","<<Coord[ID1].first<<","<<Coord[ID1].second<<","<<Coord[ID2].first<<","<<Coord[ID2].second<<","<<weightT<<endl;
                 edgeID++;
             }
@@ -707,7 +706,7 @@ void WriteEdgeCSVFile(string filename, vector<vector<pair<int,int>>>& Neighbors,
 
 }
 
-void WriteNodeCSVFile(string filename, vector<vector<pair<int,int>>>& Neighbors, vector<pair<double,double>>& Coord){
+void WriteNodeCSVFile(string filename, CSRGraph& Neighbors, vector<pair<double,double>>& Coord){
     ifstream IF(filename);
     if(IF.is_open()  && !ifNew){//already exists
         cout<<"File "<<filename<<" already exists."<<endl;
@@ -725,7 +724,7 @@ void WriteNodeCSVFile(string filename, vector<vector<pair<int,int>>>& Neighbors,
         int ID1, ID2, weightT;
 
         OF << "nodeID,lon,lat" << endl;
-        for (int i = 0; i < Neighbors.size(); ++i) {
+        for (int i = 0; i < Neighbors.nodeNum; ++i) {
             ID1 = i;
             OF << ID1 << "," << Coord[ID1].first << "," << Coord[ID1].second << endl;
         }
@@ -735,7 +734,7 @@ void WriteNodeCSVFile(string filename, vector<vector<pair<int,int>>>& Neighbors,
     }
 }
 
-void ReadGraph(string& filename, int& node_num, int& edge_num, vector<vector<pair<int,int>>>& Neighbors){
+void ReadGraph(string& filename, int& node_num, int& edge_num, CSRGraph& Neighbors){
     ifstream IF(filename, ios::in);
     if (!IF.is_open()) {
         cout << "Open file failed!" << filename << endl;
@@ -756,7 +755,8 @@ void ReadGraph(string& filename, int& node_num, int& edge_num, vector<vector<pai
 
     edge_num=stoi(vs[1]);
     cout<<"Node number: "<<node_num<<" , edge number: "<<edge_num<<endl;
-    Neighbors.assign(node_num,vector<pair<int,int>>());
+    vector<CSREdge> edges;
+    edges.reserve(edge_num);
     while(getline(IF,line)){
         if(line.empty()) continue;
         istringstream iss(line);
@@ -766,12 +766,13 @@ void ReadGraph(string& filename, int& node_num, int& edge_num, vector<vector<pai
         }
 
         if(ID1>=0 && ID1<node_num && ID2>=0 && ID2<node_num && weightT>0){
-            Neighbors[ID1].emplace_back(ID2,weightT);
+            edges.push_back({ID1,ID2,0,weightT});
         }else{
             cout<<"Graph data is wrong! "<<ID1<<" "<<ID2<<" "<<weightT<<endl;
         }
     }
     IF.close();
+    Neighbors.Build(node_num,edges,false,true);
 }
 
 void ReadCoordinate(string& filename, int& node_num, vector<pair<double,double>>& Coord){
@@ -13,11 +13,23 @@
 #include <sstream>
 #include <fstream>
 #include <map>
+#include <unordered_map>
 #include <string>
+#include <cstring>
+#include <string_view>
+#include <charconv>
 #include <vector>
 #include <chrono>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/classification.hpp>
+#include "CSRGraph.h"
 
 using namespace std;
 
@@ -40,18 +52,369 @@ struct Timer
     }
 };
 
+struct MappedFile//read-only memory map of a whole file
+{
+    const char* data=nullptr;
+    size_t size=0;
+    int fd=-1;
+    bool open(const string& filename)
+    {
+        fd=::open(filename.c_str(), O_RDONLY);
+        if(fd<0) return false;
+        struct stat st;
+        if(fstat(fd,&st)!=0){
+            close(); return false;
+        }
+        size=st.st_size;
+        if(size>0){
+            void* p=mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(p==MAP_FAILED){
+                size=0; close(); return false;
+            }
+            madvise(p, size, MADV_SEQUENTIAL);
+            data=(const char*)p;
+        }
+        return true;
+    }
+    void close()
+    {
+        if(data!=nullptr) munmap((void*)data, size);
+        if(fd>=0) ::close(fd);
+        data=nullptr; size=0; fd=-1;
+    }
+    ~MappedFile()
+    {
+        close();
+    }
+};
+
+struct StreamUpdate//one edge update of the stream
+{
+    unsigned long long int time;
+    int ID1, ID2, weight;
+};
+
+struct SlotUpdate//one edge weight of a batch time slot
+{
+    int slot, ID, weight;
+};
+
+int changePolicy=0;//policy of the batch updates, 0: threshold or ratio, 1: threshold, 2: ratio, 3: EWMA-smoothed threshold or ratio, 4: hysteresis band
+const double changeThreshold=20;//seconds
+const double increaseRatio=1;//100%
+const double decreaseRatio=0.5;//50%
+const double ewmaAlpha=0.5;//weight of the latest slot in the EWMA
+const double hysteresisEnter=1;//100% slower than the graph weight
+const double hysteresisExit=0.5;//50% slower than the graph weight
+
+//policies of deciding whether the average weight w of an edge in a time slot becomes a batch update, State is the per-edge state from the edge weight baseW of the graph
+struct ThresholdRatioChange//the weight changes by more than changeThreshold seconds, or increases by more than increaseRatio, or decreases by more than decreaseRatio
+{
+    struct State{ int weight; };//last updated weight
+    static State Init(int baseW){ return {baseW}; }
+    static bool Changed(double change, int oldW){
+        return (change>0 && (change>changeThreshold || change/oldW>increaseRatio)) || (change<0 && (-change>changeThreshold || -change/oldW>decreaseRatio));
+    }
+    static bool Update(State& state, int w, int& newW){
+        if(!Changed(w-state.weight, state.weight)) return false;
+        state.weight=newW=w;
+        return true;
+    }
+};
+
+struct ThresholdChange//the weight changes by more than changeThreshold seconds
+{
+    struct State{ int weight; };
+    static State Init(int baseW){ return {baseW}; }
+    static bool Update(State& state, int w, int& newW){
+        if(abs(w-state.weight)<=changeThreshold) return false;
+        state.weight=newW=w;
+        return true;
+    }
+};
+
+struct RatioChange//the weight increases by more than increaseRatio or decreases by more than decreaseRatio
+{
+    struct State{ int weight; };
+    static State Init(int baseW){ return {baseW}; }
+    static bool Update(State& state, int w, int& newW){
+        double change=w-state.weight;
+        if(!((change>0 && change/state.weight>increaseRatio) || (change<0 && -change/state.weight>decreaseRatio))) return false;
+        state.weight=newW=w;
+        return true;
+    }
+};
+
+struct EWMAChange//the exponentially weighted moving average (factor ewmaAlpha) of the weights satisfies ThresholdRatioChange, the average is the new weight
+{
+    struct State{ double average; int weight; };
+    static State Init(int baseW){ return {(double)baseW, baseW}; }
+    static bool Update(State& state, int w, int& newW){
+        state.average=ewmaAlpha*w+(1-ewmaAlpha)*state.average;
+        int averageW=max(1,(int)lround(state.average));
+        if(!ThresholdRatioChange::Changed(averageW-state.weight, state.weight)) return false;
+        state.weight=newW=averageW;
+        return true;
+    }
+};
+
+struct HysteresisChange//the edge becomes slow if the weight exceeds baseW*(1+hysteresisEnter) and becomes normal again only if it is below baseW*(1+hysteresisExit), only the transitions are updates
+{
+    struct State{ int baseW; bool slow; };
+    static State Init(int baseW){ return {baseW, false}; }
+    static bool Update(State& state, int w, int& newW){
+        if(!state.slow && w>state.baseW*(1+hysteresisEnter)){
+            state.slow=true;
+        }else if(state.slow && w<state.baseW*(1+hysteresisExit)){
+            state.slow=false;
+        }else{
+            return false;
+        }
+        newW=w;
+        return true;
+    }
+};
+
+struct VertexGrid//uniform grid over the vertex coordinates for the nearest vertex search
+{
+    double minLon=0, minLat=0, cellSize=1;
+    int xNum=0, yNum=0;
+    double maxAbsLat=0;//largest absolute latitude of the vertices
+    const vector<pair<double,double>>* coordinate=nullptr;
+    vector<int> cellStart;//the vertices of cell (x,y) are cellVertex[cellStart[y*xNum+x]] to cellVertex[cellStart[y*xNum+x+1]-1]
+    vector<int> cellVertex;
+    void Build(const vector<pair<double,double>>& Coordinate);
+    int Nearest(const pair<double,double>& point, double maxDis, double& dis) const;
+};
+
+struct TrajectoryBlock//columnar storage of a group of trajectories
+{
+    vector<string> carDict;//distinct car IDs of the block
+    vector<int> carID;//index into carDict
+    vector<int> carType;//1: private car; 2: taxi; 0: others
+    vector<int> travelDis, travelTime, travelSpeed;
+    vector<unsigned long long int> startTime, endTime;
+    vector<pair<double,double>> startPoint, endPoint;//gps
+    //the links (times, speeds, cities) of trajectory i are links[linkOffset[i]] to links[linkOffset[i+1]-1]
+    vector<unsigned long long int> linkOffset, timeOffset, speedOffset, cityOffset;
+    vector<long long int> links;
+    vector<unsigned long long int> linkTime;
+    vector<int> linkSpeed, linkCity;
+    unordered_map<string,int> carIndex;//from car ID to its position in carDict, only used when appending
+
+    TrajectoryBlock()
+    {
+        clear();
+    }
+    size_t size() const
+    {
+        return startTime.size();
+    }
+    int linkNum(int i) const
+    {
+        return linkOffset[i+1]-linkOffset[i];
+    }
+    void clear();
+    int AddCar(string_view id);
+    void AddTrajectory(const TrajectoryBlock& block, int i);
+};
+
+struct TrajectoryIndex//sparse index of a trajectory file, one entry per block of trajectoryBlockSize trajectories
+{
+    unsigned long long int tripNum=0, fileSize=0;//of the indexed file, used to detect a stale index
+    vector<unsigned long long int> offset;//byte offset of the block
+    vector<unsigned long long int> minStart, maxEnd;//earliest start time and latest end time of the block
+    void clear()
+    {
+        tripNum=0, fileSize=0;
+        offset.clear(); minStart.clear(); maxEnd.clear();
+    }
+    bool Read(const string& file);
+    bool Write(const string& file);
+};
+
+struct TrajectoryGrid//uniform lon/lat grid over the start and end points of a trajectory file, from cell to the ordinal numbers of its trajectories
+{
+    double cellSize=0;
+    unsigned long long int tripNum=0;//of the indexed file, used to detect a stale grid
+    map<pair<int,int>,vector<unsigned int>> cells;//ordinal numbers are increasing in each cell
+    pair<int,int> Cell(const pair<double,double>& p) const
+    {
+        return make_pair((int)floor((p.first+180)/cellSize), (int)floor((p.second+90)/cellSize));
+    }
+    void Add(const pair<double,double>& startPoint, const pair<double,double>& endPoint, unsigned int ordinal);
+    void Candidates(pair<double,double> lonP, pair<double,double> latP, vector<unsigned int>& ordinals) const;
+    bool Read(const string& file);
+    bool Write(const string& file);
+};
+
+struct RegionPolygon//polygons (with holes) of a region boundary, the edges are bucketed by latitude bands for the point-in-polygon test
+{
+    vector<pair<double,double>> edgeStart, edgeEnd;//edges of all rings
+    double minLon=INT16_MAX, maxLon=-INT16_MAX, minLat=INT16_MAX, maxLat=-INT16_MAX;
+    double bandHeight=1;
+    vector<vector<int>> bands;//edges overlapping each latitude band
+    bool Read(const string& file);
+    void AddRing(OGRLinearRing* ring);
+    void Build();
+    bool Contain(const pair<double,double>& p) const;
+};
+
+struct TargetRegion//a lon/lat box (and optionally a polygon inside it), the trajectories starting or ending in it are written to outputFile
+{
+    string outputFile;
+    pair<double,double> lonP, latP;
+    bool ifPolygon=false;
+    RegionPolygon polygon;
+    TrajectoryBlock trips;//target trajectories, written sorted by start time
+    unsigned long long int minTime=INT64_MAX, maxTime=0;
+    double minLon=INT16_MAX, minLat=INT16_MAX;
+    double maxLon=-INT16_MAX, maxLat=-INT16_MAX;
+    bool Contain(const pair<double,double>& p) const
+    {
+        return p.first>lonP.first && p.first<lonP.second && p.second>latP.first && p.second<latP.second && (!ifPolygon || polygon.Contain(p));
+    }
+    void Add(const TrajectoryBlock& block, int i);
+};
+
+struct TrajectoryWriter//writer of the text or binary trajectory file, trajectories are appended one by one
+{
+    ofstream OF;
+    string filename;
+    bool binary=false;
+    unsigned int version=1;//1: plain columns, 2: delta and varint encoded link and time columns
+    unsigned long long int tripNum=0, blockNum=0;
+    streampos countPos;
+    TrajectoryBlock block;//trajectories not yet flushed (binary only)
+    bool ifIndex=false;//whether to write the block index to file+".index"
+    TrajectoryIndex index;
+    bool open(const string& file, int format, bool ifIndex=false);
+    void Write(const TrajectoryBlock& source, int i);
+    void FlushBlock();
+    bool close();//return false if the block index cannot be written
+};
+
+struct TrajectoryReader//reader of the text or binary trajectory file, the format is detected from the file header
+{
+    MappedFile IF;
+    bool binary=false;
+    unsigned int version=0;
+    vector<string_view> vs;//fields of one text row
+    unsigned long long int tripNum=0;//trajectory number recorded in the file header
+    size_t pos=0;
+    bool ifIndex=false;//whether a valid block index was found
+    TrajectoryIndex index;
+    int blockI=0;//next index entry to visit
+    bool open(const string& file);
+    bool ReadBlock(TrajectoryBlock& block);//read the next group of trajectories, return false at the end of file
+    bool ReadBlock(TrajectoryBlock& block, unsigned long long int startT, unsigned long long int endT);//only visit the blocks that may contain trajectories overlapping [startT,endT]
+    void ReadBlockAt(TrajectoryBlock& block, int bi);//read block bi of an indexed file
+    void close()
+    {
+        IF.close();
+    }
+};
+
 vector<string> split(const string &s, const string &seperator);
-void TrajectoryExtract(string sourceFile, string outputFile, vector<string>& sourceFiles);
-void GetTargetTrajectory(vector<string> sourceFiles, string outputFile, pair<double,double> lonP, pair<double,double> latP);
+void SplitView(string_view s, char seperator, vector<string_view>& result);
+bool NextLine(const MappedFile& mf, size_t& pos, string_view& line);
+long long int ViewToLL(string_view s);
+bool ViewToLL(string_view s, long long int& value);
+bool FieldToLL(string_view s, long long int& value);
+int DenseIndex(const vector<long long int>& keys, long long int key);
+double ViewToDouble(string_view s);
+bool ViewToDouble(string_view s, double& value);
+int ListSize(const vector<string_view>& vs, int& index_i, string_view line);
+template <class T>
+void WriteColumn(ofstream& OF, const vector<T>& column);
+template <class T>
+void EncodeDeltaVarint(string& bytes, const T* values, size_t num, long long int base);
+template <class T>
+void DecodeDeltaVarint(const unsigned char*& p, const unsigned char* end, T* values, size_t num, long long int base);
+template <class T>
+void ReadColumn(const MappedFile& IF, size_t& pos, vector<T>& column, size_t num);
+bool TrajectoryExtract(string sourceFile, string outputFile, vector<string>& sourceFiles, ostream& log);
+void TrajectoryExtractParallel(vector<pair<string,string>>& extractFiles, vector<string>& sourceFiles, int threadNum);
+template <class T, class Key>
+void RadixSort(vector<T>& items, Key key);
+void GetTargetTrajectory(vector<string> sourceFiles, vector<TargetRegion>& regions);
+void ReadRegions(string regionFile, string targetPath, vector<TargetRegion>& regions);
 void GetEdgeUpdates(string graphFile, string edgeNodeFile, string edgeIDFile, string trajectoryFile, string outputFile, unsigned long long int startT, unsigned long long int endT);
 void GetStreamUpdatesAndQueriesLCC(string graphFile, string edgeNodeFile, string edgeIDFile, string nodeIDFile, string trajectoryFile, unsigned long long int startT, unsigned long long int endT);
 void GetBatchUpdatesLCC(string graphFile, string edgeNodeFile, string edgeIDFile, string updateFile, string outputFile, int batchInterval, pair<unsigned long long int, unsigned long long int> timeRange);
-void GetBatchUpdatesLCCs(string graphFile, string edgeNodeFile, string edgeIDFile, string updateFile, int batchInterval,  vector<int>& dayIDs, vector<pair<unsigned long long int, unsigned long long int>>& timeRanges);
+void GetBatchUpdatesLCCs(string graphFile, string edgeNodeFile, string edgeIDFile, string updateFile, vector<int>& batchIntervals,  vector<int>& dayIDs, vector<pair<unsigned long long int, unsigned long long int>>& timeRanges);
+void TrimObservations(vector<pair<int,unsigned long long int>>& weights);
+bool WriteBatchUpdates(const string& outputFile, int slotNum, int batchInterval, const vector<map<pair<int,int>,int>>& batchUpdatesFinal, ostream& log);
+template <class EdgeOf>
+void DetectBatchChanges(const vector<SlotUpdate>& slotUpdates, int slotNum, EdgeOf edgeOf, vector<map<pair<int,int>,int>>& batchUpdatesFinal, ostream& log);
+template <class Policy, class EdgeOf>
+void DetectChanges(const vector<SlotUpdate>& slotUpdates, int slotNum, EdgeOf edgeOf, vector<map<pair<int,int>,int>>& batchUpdatesFinal, ostream& log);
 double EuclideanDis(pair<double,double> s, pair<double,double> t);//return distance in meter
+int QueryVertex(const pair<int,int>& edgeNode, const pair<double,double>& point, const vector<pair<double,double>>& Coordinate, const VertexGrid& grid, int& snapNum);
 bool ifNew=false;
+int threadNum=1;//worker number for the multi-file steps
+int trajectoryFormat=0;//format of the extracted trajectory files, 0: text, 1: binary columnar, 2: binary columnar with delta and varint encoded links and times
+const int trajectoryBlockSize=4096;//trajectory number per block of the binary file
+const char trajectoryMagic[4]={'T','R','J','B'};
+int batchFormat=0;//format of the batch update files, 0: text .batchUpdates, 1: binary .batchUpdatesBin with a slot offset table
+const char batchMagic[4]={'B','U','P','B'};
+const double gridCellSize=0.1;//cell size (degree) of the spatial grid of the extracted trajectory files
+const double querySnapDis=100;//maximal EuclideanDis from a query start or end point to its vertex
+double trimUpper=0.95;//the observations of an edge above this percentile of edge weight are removed
+double trimLower=0;//the observations of an edge below or at this percentile of edge weight are removed
+const int trimMinNum=4;//minimal observation number of an edge for the trimming
 
 int main(int argc, char** argv)
 {
+    //options may appear anywhere, the remaining arguments are positional
+    vector<char*> args;
+    string regionFile;//file of the additional named regions
+    string polygonFile;//boundary of the dataset region
+    for(int i=0;i<argc;++i){
+        if(strcmp(argv[i],"--threads")==0 && i+1<argc){
+            threadNum=max(1,stoi(argv[++i]));
+        }else if(strcmp(argv[i],"--polygon")==0 && i+1<argc){
+            polygonFile=argv[++i];
+        }else if(strcmp(argv[i],"--regions")==0 && i+1<argc){
+            regionFile=argv[++i];
+        }else if(strcmp(argv[i],"--trim-upper")==0 && i+1<argc){
+            trimUpper=stod(argv[++i]);
+        }else if(strcmp(argv[i],"--trim-lower")==0 && i+1<argc){
+            trimLower=stod(argv[++i]);
+        }else if(strcmp(argv[i],"--change")==0 && i+1<argc){
+            string policy=argv[++i];
+            if(policy=="default") changePolicy=0;
+            else if(policy=="threshold") changePolicy=1;
+            else if(policy=="ratio") changePolicy=2;
+            else if(policy=="ewma") changePolicy=3;
+            else if(policy=="hysteresis") changePolicy=4;
+            else{
+                cout<<"Wrong change policy "<<policy<<endl; exit(1);
+            }
+        }else if(strcmp(argv[i],"--batch-format")==0 && i+1<argc){
+            string format=argv[++i];
+            if(format=="text") batchFormat=0;
+            else if(format=="binary") batchFormat=1;
+            else{
+                cout<<"Wrong batch update format "<<format<<endl; exit(1);
+            }
+        }else if(strcmp(argv[i],"--format")==0 && i+1<argc){
+            string format=argv[++i];
+            if(format=="text") trajectoryFormat=0;
+            else if(format=="binary") trajectoryFormat=1;
+            else if(format=="compressed") trajectoryFormat=2;
+            else{
+                cout<<"Wrong trajectory format "<<format<<endl; exit(1);
+            }
+        }else{
+            args.push_back(argv[i]);
+        }
+    }
+    argc=args.size(); argv=args.data();
+    if(trimLower<0 || trimUpper>1 || trimLower>=trimUpper){
+        cout<<"Wrong trimming percentiles "<<trimLower<<" "<<trimUpper<<endl; exit(1);
+    }
+
     if( argc < 5 || argc > 10){
         printf("usage:\n<arg1> trajectory source path, e.g. /data/TrajectoryData/CennaviData/BasicTrajectory/m=01/\n");
         printf("<arg2> trajectory target path, e.g. /data/xzhouby/datasets/trajectoryData/m=01/\n");
@@ -62,6 +425,14 @@ int main(int argc, char** argv)
         printf("<arg7> minimum latitude (optional), e.g. 20.0833\n");
         printf("<arg8> maximum latitude (optional), e.g. 25.6667\n");
         printf("<arg9> process again (optional), 0: No, 1: Yes. default: 0\n");
+        printf("--threads N (optional), worker number for extracting trajectory files, deriving the edge updates and building the graph. default: 1\n");
+        printf("--polygon file (optional), boundary (polygon or multipolygon vector file, e.g. .shp) of the dataset region, used together with the longitude and latitude range\n");
+        printf("--regions file (optional), additional regions extracted in the same pass, one region per line: name minLon maxLon minLat maxLat, or name boundaryFile\n");
+        printf("--trim-upper P (optional), percentile of edge weight above which the observations of an edge are removed before the batch updates. default: 0.95\n");
+        printf("--trim-lower P (optional), percentile of edge weight below or at which the observations of an edge are removed before the batch updates. default: 0\n");
+        printf("--change default|threshold|ratio|ewma|hysteresis (optional), policy of turning the average slot weights into batch updates. default: default (change > 20 s, increase > 100%% or decrease > 50%%)\n");
+        printf("--format text|binary|compressed (optional), format of the extracted .valid and .trajectory files. default: text\n");
+        printf("--batch-format text|binary (optional), format of the batch update files, text .batchUpdates or binary .batchUpdatesBin. default: text\n");
         exit(0);
     }
     string sourcePath="/Users/zhouxj/Documents/1-Research/Datasets/NavInfo/trajectory/m=01/d=01/BASIS_TRAJECTORY_2016_";
@@ -99,16 +470,22 @@ int main(int argc, char** argv)
 
     /// Step 1: Get extracted trajectories
     cout<<"Step 1: extract valid trajectories (From Dec 1st 2015 to Feb 1st 2016, GMT+8)."<<endl;
+    vector<pair<string,string>> extractFiles;//raw trajectory file, extracted file
     for(int di=1;di<=5;++di) {
         string dayPath = sourcePath+"d=0"+ to_string(di)+"/BASIS_TRAJECTORY_2016_";
         string dayPath2 = targetPath+"d=0"+ to_string(di)+"/BASIS_TRAJECTORY_2016_";
         for (int i = 0; i < 30; ++i) {
-            string path1 = dayPath + to_string(i);
-            TrajectoryExtract(path1, dayPath2 + to_string(i) + ".valid", sourceFiles);
-//            cout << "File " << i << " done." << endl;
-//        sourceFiles.push_back(targetPath + "/BASIS_TRAJECTORY_2016_" + to_string(i) + ".extract");
+            extractFiles.emplace_back(dayPath + to_string(i), dayPath2 + to_string(i) + ".valid");
+        }
+    }
+    if(threadNum>1){
+        TrajectoryExtractParallel(extractFiles, sourceFiles, threadNum);
+    }else{
+        for(int i=0;i<extractFiles.size();++i){
+            if(!TrajectoryExtract(extractFiles[i].first, extractFiles[i].second, sourceFiles, cout)){
+                exit(1);
+            }
         }
-//        cout<<endl;
     }
     cout<<endl;
 
@@ -124,7 +501,19 @@ int main(int argc, char** argv)
 //    GetTargetTrajectory(sourceFiles, targetPath + "/"+dataset+".trajectory", make_pair(109.5,117.25), make_pair(20.0833,25.6667));//Guangdong
     cout<<"Extracted trajectory file number: "<<sourceFiles.size()<<endl;
 
-    GetTargetTrajectory(sourceFiles, targetPath +dataset+".trajectory", make_pair(minLon,maxLon), make_pair(minLat,maxLat));
+    vector<TargetRegion> regions(1);//the first region is the dataset of the following steps
+    regions[0].outputFile=targetPath +dataset+".trajectory";
+    regions[0].lonP=make_pair(minLon,maxLon), regions[0].latP=make_pair(minLat,maxLat);
+    if(!polygonFile.empty()){
+        if(!regions[0].polygon.Read(polygonFile)){
+            cout<<"No polygon in "<<polygonFile<<"!"<<endl; exit(1);
+        }
+        regions[0].ifPolygon=true;
+    }
+    if(!regionFile.empty()){
+        ReadRegions(regionFile, targetPath, regions);
+    }
+    GetTargetTrajectory(sourceFiles, regions);
 
 
 
@@ -149,12 +538,8 @@ int main(int argc, char** argv)
     updateIntervals.push_back(300); updateIntervals.push_back(900);
 //    updateIntervals.push_back(120); updateIntervals.push_back(600);
 
-    for(int j=0;j<updateIntervals.size();++j){
-        int updateInterval=updateIntervals[j];
-        cout<<"Update interval: "<<updateInterval<<" s."<<endl;
-        GetBatchUpdatesLCCs(graphFile, graphFile+"_EdgeToNodeMap", graphFile+"_EdgeIDMap", updateFile, updateInterval, dayIDs, dayIntervals);
-        cout<<endl;
-    }
+    GetBatchUpdatesLCCs(graphFile, graphFile+"_EdgeToNodeMap", graphFile+"_EdgeIDMap", updateFile, updateIntervals, dayIDs, dayIntervals);//all update intervals from one load of the edge updates
+    cout<<endl;
 
 
     cout<<"Done."<<endl;
@@ -170,9 +555,9 @@ void GetBatchUpdatesLCC(string graphFile, string edgeNodeFile, string edgeIDFile
     vector<long long int> EdgeIDMapV;//map from new edge ID to old edge ID
     vector<map<unsigned long long int,int>> EdgeTrajectory;//new edge ID, time, edge weight
     vector<pair<int,int>> Edges;//new edge ID, distance, travel time
-    vector<map<int,vector<int>>> batchUpdates;//batch updates, <time slot, <new edge ID, vector<edge weights>>
+    vector<SlotUpdate> slotUpdates;//batch updates, <time slot, new edge ID, edge weight>
     vector<map<pair<int,int>,int>> batchUpdatesFinal;
-    vector<map<int,int>> NeighborsMap;
+    CSRGraph graph;//time graph of LCC
     unsigned long long int time;
     int ID1,ID2,weightT;
     int node_num, edge_num;
@@ -180,7 +565,6 @@ void GetBatchUpdatesLCC(string graphFile, string edgeNodeFile, string edgeIDFile
 
     int slotNum=(timeRange.second-timeRange.first)/batchInterval;
     cout<<"Time slot number: "<<slotNum<<" ; time range: [ "<<timeRange.first<<" "<<timeRange.second<<" ]"<<endl;
-    batchUpdates.assign(slotNum,map<int,vector<int>>());
 
     // Step 1: read edge ID map
     ifstream IF1(edgeIDFile, ios::in);
@@ -253,7 +637,8 @@ void GetBatchUpdatesLCC(string graphFile, string edgeNodeFile, string edgeIDFile
     boost::split(vs,line,boost::is_any_of(" "));
     node_num=stoi(vs[0]), edge_num=stoi(vs[1]);
     cout<<"Node number: "<<node_num<<" , edge number: "<<edge_num<<endl;
-    NeighborsMap.assign(node_num,map<int,int>());
+    vector<CSREdge> graphEdges;
+    graphEdges.reserve(edge_num);
     while(getline(IF3,line)){
         if(line.empty()) continue;
         istringstream iss(line);
@@ -263,12 +648,14 @@ void GetBatchUpdatesLCC(string graphFile, string edgeNodeFile, string edgeIDFile
         }
 
         if(ID1>=0 && ID1<node_num && ID2>=0 && ID2<node_num && weightT>0){
-            NeighborsMap[ID1].insert({ID2,weightT});
+            graphEdges.push_back({ID1,ID2,0,weightT});
         }else{
             cout<<"Graph data is wrong! "<<ID1<<" "<<ID2<<" "<<weightT<<endl;
         }
     }
     IF3.close();
+    graph.Build(node_num,graphEdges,false,true,threadNum);//Find returns the first edge of a vertex pair
+    vector<CSREdge>().swap(graphEdges);
 
     // Step 4: read node ID map of LCC
     ifstream IF4(graphFile+".IDMap", ios::in);
@@ -324,100 +711,40 @@ void GetBatchUpdatesLCC(string graphFile, string edgeNodeFile, string edgeIDFile
             weightT = stoi(vs[2*j+4]);
             weights.emplace_back(weightT, time);
         }
-        sort(weights.begin(),weights.end());
+        TrimObservations(weights);//remove the slowest (and optionally the fastest) trajectories
         for(int j=0;j<weights.size();++j){//arrange the updates to different time slots
             time = weights[j].second;
             weightT = weights[j].first;
-            double ratio=j+1;
-            ratio/=temp;
-            if(ratio > 0.95 && temp>3){//remove the top-5% slowest trajectory
-//                    cout<<j<<" "<<temp<<" "<<ratio<<endl;
-                break;
-            }
             int slotID=(time - timeRange.first)/batchInterval;
             if(slotID>=0 && slotID<slotNum){
-                if(batchUpdates[slotID].find(i)==batchUpdates[slotID].end()){//if not found
-                    batchUpdates[slotID].insert({i,vector<int>()});
-                }
-                batchUpdates[slotID][i].push_back(weightT);
+                slotUpdates.push_back({slotID,i,weightT});
             }
         }
     }
     IF.close();
+    RadixSort(slotUpdates, [](const SlotUpdate& u){ return (unsigned long long int)u.slot; });//stable, the edges of a slot stay in increasing order
 
 
     // Step 6: obtain valid updates: remove invalid edges and compute the average edge weights
-    batchUpdatesFinal.assign(slotNum,map<pair<int,int>,int>());
+    auto edgeOf=[&](int eID, int& ID1, int& ID2, int& baseW){//LCC edge of new edge ID eID and its weight in the graph
+        long long int edgeID=EdgeIDMapV[eID];//old edge ID
+        auto itEdge=EdgeToNode.find(edgeID);
+        if(itEdge==EdgeToNode.end()){
+            cout<<"Wrong. No edge "<<edgeID<<endl; exit(1);
+        }
+        auto itID1=oldToNewNodeID.find(itEdge->second.first), itID2=oldToNewNodeID.find(itEdge->second.second);
+        if(itID1==oldToNewNodeID.end() || itID2==oldToNewNodeID.end()) return false;
+        ID1=min(itID1->second,itID2->second), ID2=max(itID1->second,itID2->second);//new node ID 2
+        long long int pos=graph.Find(ID1,ID2);
+        if(pos==-1) return false;
+        baseW=graph.time[pos];
+        return true;
+    };
+    DetectBatchChanges(slotUpdates, slotNum, edgeOf, batchUpdatesFinal, cout);
     unsigned long long int updateNum=0;
     int maxUpdateNum=0;
     int minUpdateNum=INT32_MAX;
-    map<pair<int,int>,int> existingUpdates;
-    for(int i=0;i<batchUpdates.size();++i){
-        for(auto it=batchUpdates[i].begin();it!=batchUpdates[i].end();++it){
-            int eID=it->first;//new edge ID
-            edgeID=EdgeIDMapV[eID];//old edge ID
-            if(EdgeToNode.find(edgeID)!=EdgeToNode.end()){//if found
-                ID1=EdgeToNode[edgeID].first, ID2=EdgeToNode[edgeID].second;//new node ID 1
-                if(oldToNewNodeID.find(ID1)!=oldToNewNodeID.end() && oldToNewNodeID.find(ID2)!=oldToNewNodeID.end()){
-                    ID1=oldToNewNodeID[ID1], ID2=oldToNewNodeID[ID2];//new node ID 2
-                    if(ID1>ID2){
-                        int temp=ID1;
-                        ID1=ID2, ID2=temp;
-                    }
-                    if(NeighborsMap[ID1].find(ID2)!=NeighborsMap[ID1].end()){//if found
-                        //compute average edge weight
-                        int tempSum=0;
-                        for(auto it2=it->second.begin();it2!=it->second.end();++it2){
-                            tempSum+=*it2;
-                        }
-                        tempSum=ceil(tempSum/it->second.size());
-                        if(tempSum<1){
-                            tempSum=1;
-                            cout<<"Smaller than 1 "<<tempSum<<endl;
-                        }
-
-                        if(existingUpdates.find(make_pair(ID1,ID2))!=existingUpdates.end()){//if found
-                            int oldW=existingUpdates[make_pair(ID1,ID2)];
-                            double tempChange=tempSum-oldW;
-                            if(tempChange>0){
-                                if(tempChange > 20 || tempChange/oldW > 1){//if the time change is larger than 20 seconds or the edge increase ratio is larger than 100%
-                                    batchUpdatesFinal[i].insert({make_pair(ID1,ID2),tempSum});
-                                    existingUpdates[make_pair(ID1,ID2)]=tempSum;
-                                }
-                            }else if(tempChange<0){
-                                if(tempChange > 20 || -tempChange/oldW > 0.5){//if the time change is larger than 20 seconds or the edge decrease ratio is larger than 50%
-                                    batchUpdatesFinal[i].insert({make_pair(ID1,ID2),tempSum});
-                                    existingUpdates[make_pair(ID1,ID2)]=tempSum;
-                                }
-                            }
-
-                        }else{//if not found
-                            int oldW=NeighborsMap[ID1][ID2];
-                            double tempChange=tempSum-oldW;
-                            if(tempChange>0){
-                                if(tempChange > 20 || tempChange/oldW > 1){//if the time change is larger than 20 seconds or the edge increase ratio is larger than 100%
-                                    batchUpdatesFinal[i].insert({make_pair(ID1,ID2),tempSum});
-                                    existingUpdates[make_pair(ID1,ID2)]=tempSum;
-                                }
-                            }else if(tempChange<0){
-                                if(tempChange > 20 || -tempChange/oldW > 0.5){//if the time change is larger than 20 seconds or the edge decrease ratio is larger than 50%
-                                    batchUpdatesFinal[i].insert({make_pair(ID1,ID2),tempSum});
-                                    existingUpdates[make_pair(ID1,ID2)]=tempSum;
-                                }
-                            }
-                        }
-
-                    }
-                }
-
-            }
-            else{
-                cout<<"Wrong. No edge "<<edgeID<<endl; exit(1);
-            }
-
-        }
-
-
+    for(int i=0;i<batchUpdatesFinal.size();++i){
         updateNum+=batchUpdatesFinal[i].size();
         if(maxUpdateNum<batchUpdatesFinal[i].size()){
             maxUpdateNum=batchUpdatesFinal[i].size();
@@ -427,40 +754,15 @@ void GetBatchUpdatesLCC(string graphFile, string edgeNodeFile, string edgeIDFile
         }
     }
     cout<<"Total update number: "<<updateNum<<" ; average update number: "<<updateNum/slotNum<<" ; maximum update number: "<<maxUpdateNum<<" ; minimum update number: "<<minUpdateNum<<endl;
-    ofstream OF1(outputFile+"Info", ios::out);
-    if (!OF1.is_open()) {
-        cout << "Open file failed!" << outputFile+"Info" << endl;
-        exit(1);
-    }
-    OF1<<slotNum<<endl;
-    for(int i=0;i<batchUpdatesFinal.size();++i){
-        OF1<<i<<" "<<batchUpdatesFinal[i].size()<<endl;
-    }
-    OF1.close();
-
-    ofstream OF(outputFile, ios::out);
-    if (!OF.is_open()) {
-        cout << "Open file failed!" << outputFile << endl;
+    if(!WriteBatchUpdates(outputFile, slotNum, batchInterval, batchUpdatesFinal, cout)){
         exit(1);
     }
 
-    OF<<slotNum<<" "<<batchInterval<<endl;
-    for(int i=0;i<batchUpdatesFinal.size();++i){
-        OF<<batchUpdatesFinal[i].size();
-        for(auto it=batchUpdatesFinal[i].begin();it!=batchUpdatesFinal[i].end();++it){
-            ID1=it->first.first, ID2=it->first.second, weightT=it->second;
-            OF<<" "<<ID1<<" "<<ID2<<" "<<weightT;
-
-        }
-        OF<<endl;
-    }
-    OF.close();
-
     tt.stop();
     cout<<"CPU elapsed time: "<<tt.GetRuntime()<<" s."<<endl;
 }
 
-void GetBatchUpdatesLCCs(string graphFile, string edgeNodeFile, string edgeIDFile, string updateFile, int batchInterval, vector<int>& dayIDs, vector<pair<unsigned long long int, unsigned long long int>>& timeRanges){
+void GetBatchUpdatesLCCs(string graphFile, string edgeNodeFile, string edgeIDFile, string updateFile, vector<int>& batchIntervals, vector<int>& dayIDs, vector<pair<unsigned long long int, unsigned long long int>>& timeRanges){
 
     Timer tt;
     tt.start();
@@ -471,9 +773,7 @@ void GetBatchUpdatesLCCs(string graphFile, string edgeNodeFile, string edgeIDFil
     vector<map<unsigned long long int,int>> EdgeTrajectory;//new edge ID, time, edge weight
     vector<pair<int,int>> Edges;//new edge ID, distance, travel time
     vector<vector<pair<int,unsigned long long int>>> EdgeUpdates;//new edge ID, edge weight, time stamp
-    vector<map<int,vector<int>>> batchUpdates;//batch updates, <time slot, <new edge ID, vector<edge weights>>
-    vector<map<pair<int,int>,int>> batchUpdatesFinal;
-    vector<map<int,int>> NeighborsMap;
+    CSRGraph graph;//time graph of LCC
     unsigned long long int time;
     int ID1,ID2,weightT;
     int node_num, edge_num;
@@ -552,7 +852,8 @@ void GetBatchUpdatesLCCs(string graphFile, string edgeNodeFile, string edgeIDFil
     boost::split(vs,line,boost::is_any_of(" "));
     node_num=stoi(vs[0]), edge_num=stoi(vs[1]);
     cout<<"Node number: "<<node_num<<" , edge number: "<<edge_num<<endl;
-    NeighborsMap.assign(node_num,map<int,int>());
+    vector<CSREdge> graphEdges;
+    graphEdges.reserve(edge_num);
     while(getline(IF3,line)){
         if(line.empty()) continue;
         istringstream iss(line);
@@ -562,12 +863,14 @@ void GetBatchUpdatesLCCs(string graphFile, string edgeNodeFile, string edgeIDFil
         }
 
         if(ID1>=0 && ID1<node_num && ID2>=0 && ID2<node_num && weightT>0){
-            NeighborsMap[ID1].insert({ID2,weightT});
+            graphEdges.push_back({ID1,ID2,0,weightT});
         }else{
             cout<<"Graph data is wrong! "<<ID1<<" "<<ID2<<" "<<weightT<<endl;
         }
     }
     IF3.close();
+    graph.Build(node_num,graphEdges,false,true,threadNum);//Find returns the first edge of a vertex pair
+    vector<CSREdge>().swap(graphEdges);
 
     /// Step 4: read node ID map of LCC
     ifstream IF4(graphFile+".IDMap", ios::in);
@@ -628,126 +931,95 @@ void GetBatchUpdatesLCCs(string graphFile, string edgeNodeFile, string edgeIDFil
             weightT = stoi(vs[2*j+6]);
             weights.emplace_back(weightT, time);
         }
-        sort(weights.begin(),weights.end());
-
-        for(int j=0;j<weights.size();++j){//arrange the updates to different time slots
-            time = weights[j].second;
-            weightT = weights[j].first;
-            double ratio=j+1;
-            ratio/=euNum;
-            if(ratio > 0.95 && euNum>3){//remove the top-5% slowest trajectory
-//                    cout<<j<<" "<<temp<<" "<<ratio<<endl;
-                continue;
-            }
-
-            EdgeUpdates[i].emplace_back(weightT,time);
-
-        }
+        TrimObservations(weights);//remove the slowest (and optionally the fastest) trajectories
+        EdgeUpdates[i].swap(weights);
     }
     IF.close();
 
 
 
 
-    /// Step 6: obtain valid updates: remove invalid edges and compute the average edge weights
-
-    for(int di=0;di<timeRanges.size();++di){
-        cout<<"Date: "<<dayIDs[di]<<endl;
-        string outputFile=graphFile+"_"+ to_string(dayIDs[di])+"_"+to_string(batchInterval)+".batchUpdates";
-        ifstream IF1(outputFile+"Info", ios::out);
-        if (IF1.is_open() && !ifNew) {//if open
-            cout << "File already exist." << endl;
-            IF1.close();
-        }else{
-            IF1.close();
+    /// Step 6: arrange the updates of all batch intervals and days to their time slots, one job per <batch interval, day>
+    vector<pair<int,int>> batchJobs;//<batch interval, day> whose output does not exist
+    for(int bi=0;bi<batchIntervals.size();++bi){
+        for(int di=0;di<timeRanges.size();++di){
+            string outputFile=graphFile+"_"+ to_string(dayIDs[di])+"_"+to_string(batchIntervals[bi])+".batchUpdates";
+            ifstream IF1(batchFormat==1?outputFile+"Bin":outputFile+"Info", ios::in);
+            if (IF1.is_open() && !ifNew) {//if open
+                cout<<"Update interval: "<<batchIntervals[bi]<<" s. Date: "<<dayIDs[di]<<endl;
+                cout << "File already exist." << endl;
+                IF1.close();
+            }else{
+                IF1.close();
+                batchJobs.emplace_back(bi,di);
+            }
+        }
+    }
+    vector<vector<SlotUpdate>> jobSlotUpdates(batchJobs.size());//batch updates of each job, <time slot, new edge ID, edge weight>
+    vector<int> jobInterval(batchJobs.size());
+    vector<unsigned long long int> jobStart(batchJobs.size()), jobSlotNum(batchJobs.size());
+    for(int k=0;k<batchJobs.size();++k){
+        jobInterval[k]=batchIntervals[batchJobs[k].first];
+        jobStart[k]=timeRanges[batchJobs[k].second].first;
+        jobSlotNum[k]=(timeRanges[batchJobs[k].second].second-jobStart[k])/jobInterval[k];
+    }
+    for(int i=0;i<edgeNum;++i){//one pass over the updates, each update goes to the jobs whose time range contains it
+        for(int j=0;j<EdgeUpdates[i].size();++j){
+            unsigned long long int t=EdgeUpdates[i][j].second;
+            for(int k=0;k<batchJobs.size();++k){
+                if(t<jobStart[k]) continue;
+                unsigned long long int slotID=(t - jobStart[k])/jobInterval[k];
+                if(slotID<jobSlotNum[k]){
+                    jobSlotUpdates[k].push_back({(int)slotID,i,EdgeUpdates[i][j].first});
+                }
+            }
+        }
+    }
+    vector<vector<pair<int,unsigned long long int>>>().swap(EdgeUpdates);
+
+    /// Step 7: obtain valid updates: remove invalid edges and compute the average edge weights, the jobs only share read-only inputs and run concurrently
+    vector<string> jobLogs(batchJobs.size());//log of each job, printed in job order
+    vector<char> jobDone(batchJobs.size(),0);//whether the job succeeded, the workers do not exit by themselves
+    ParallelFor(batchJobs.size(), threadNum, [&](int k){
+        int batchInterval=batchIntervals[batchJobs[k].first];
+        int di=batchJobs[k].second;
+        ostringstream log;
+        log<<"Update interval: "<<batchInterval<<" s. Date: "<<dayIDs[di]<<endl;
+        {
             pair<unsigned long long int, unsigned long long int> timeRange=timeRanges[di];
+            vector<SlotUpdate>& slotUpdates=jobSlotUpdates[k];
+            RadixSort(slotUpdates, [](const SlotUpdate& u){ return (unsigned long long int)u.slot; });//stable, the edges of a slot stay in increasing order
             int slotNum=(timeRange.second-timeRange.first)/batchInterval;
-            cout<<"Time slot number: "<<slotNum<<" ; time range: [ "<<timeRange.first<<" "<<timeRange.second<<" ]"<<endl;
-            batchUpdates.assign(slotNum,map<int,vector<int>>());
-            for(int i=0;i<edgeNum;++i){
-                for(int j=0;j<EdgeUpdates[i].size();++j){//arrange the updates to different time slots
-                    time = EdgeUpdates[i][j].second;
-                    weightT = EdgeUpdates[i][j].first;
-
-                    int slotID=(time - timeRange.first)/batchInterval;
-                    if(slotID>=0 && slotID<slotNum){
-                        if(batchUpdates[slotID].find(i)==batchUpdates[slotID].end()){//if not found
-                            batchUpdates[slotID].insert({i,vector<int>()});
-                        }
-                        batchUpdates[slotID][i].push_back(weightT);
-                    }
+            log<<"Time slot number: "<<slotNum<<" ; time range: [ "<<timeRange.first<<" "<<timeRange.second<<" ]"<<endl;
+
+            long long int missingEdge=-1;//first old edge ID without its end vertices, the job fails if there is one
+            auto edgeOf=[&](int eID, int& ID1, int& ID2, int& baseW){//LCC edge of new edge ID eID and its weight in the graph
+                long long int edgeID=EdgeIDMapV[eID];//old edge ID
+                auto itEdge=EdgeToNode.find(edgeID);
+                if(itEdge==EdgeToNode.end()){
+                    if(missingEdge==-1) missingEdge=edgeID;
+                    return false;
                 }
+                auto itID1=oldToNewNodeID.find(itEdge->second.first), itID2=oldToNewNodeID.find(itEdge->second.second);
+                if(itID1==oldToNewNodeID.end() || itID2==oldToNewNodeID.end()) return false;
+                ID1=min(itID1->second,itID2->second), ID2=max(itID1->second,itID2->second);//new node ID 2
+                long long int pos=graph.Find(ID1,ID2);
+                if(pos==-1) return false;
+                baseW=graph.time[pos];
+                return true;
+            };
+            vector<map<pair<int,int>,int>> batchUpdatesFinal;
+            DetectBatchChanges(slotUpdates, slotNum, edgeOf, batchUpdatesFinal, log);
+            vector<SlotUpdate>().swap(slotUpdates);
+            if(missingEdge!=-1){
+                log<<"Wrong. No edge "<<missingEdge<<endl;
+                jobLogs[k]=log.str();
+                return;
             }
-
-            batchUpdatesFinal.assign(slotNum,map<pair<int,int>,int>());
             unsigned long long int updateNum=0;
             int maxUpdateNum=0;
             int minUpdateNum=INT32_MAX;
-            map<pair<int,int>,int> existingUpdates;
-            for(int i=0;i<batchUpdates.size();++i){
-                for(auto it=batchUpdates[i].begin();it!=batchUpdates[i].end();++it){
-                    int eID=it->first;//new edge ID
-                    edgeID=EdgeIDMapV[eID];//old edge ID
-                    if(EdgeToNode.find(edgeID)!=EdgeToNode.end()){//if found
-                        ID1=EdgeToNode[edgeID].first, ID2=EdgeToNode[edgeID].second;//new node ID 1
-                        if(oldToNewNodeID.find(ID1)!=oldToNewNodeID.end() && oldToNewNodeID.find(ID2)!=oldToNewNodeID.end()){
-                            ID1=oldToNewNodeID[ID1], ID2=oldToNewNodeID[ID2];//new node ID 2
-                            if(ID1>ID2){
-                                int temp=ID1;
-                                ID1=ID2, ID2=temp;
-                            }
-                            if(NeighborsMap[ID1].find(ID2)!=NeighborsMap[ID1].end()){//if found
-                                //compute average edge weight
-                                int tempSum=0;
-                                for(auto it2=it->second.begin();it2!=it->second.end();++it2){
-                                    tempSum+=*it2;
-                                }
-                                tempSum=ceil(tempSum/it->second.size());
-                                if(tempSum<1){
-                                    tempSum=1;
-                                    cout<<"Smaller than 1 "<<tempSum<<endl;
-                                }
-
-                                if(existingUpdates.find(make_pair(ID1,ID2))!=existingUpdates.end()){//if found
-                                    int oldW=existingUpdates[make_pair(ID1,ID2)];
-                                    double tempChange=tempSum-oldW;
-                                    if(tempChange>0){
-                                        if(tempChange > 20 || tempChange/oldW > 1){//if the time change is larger than 20 seconds or the edge increase ratio is larger than 100%
-                                            batchUpdatesFinal[i].insert({make_pair(ID1,ID2),tempSum});
-                                            existingUpdates[make_pair(ID1,ID2)]=tempSum;
-                                        }
-                                    }else if(tempChange<0){
-                                        if(tempChange > 20 || -tempChange/oldW > 0.5){//if the time change is larger than 20 seconds or the edge decrease ratio is larger than 50%
-                                            batchUpdatesFinal[i].insert({make_pair(ID1,ID2),tempSum});
-                                            existingUpdates[make_pair(ID1,ID2)]=tempSum;
-                                        }
-                                    }
-
-                                }else{//if not found
-                                    int oldW=NeighborsMap[ID1][ID2];
-                                    double tempChange=tempSum-oldW;
-                                    if(tempChange>0){
-                                        if(tempChange > 20 || tempChange/oldW > 1){//if the time change is larger than 20 seconds or the edge increase ratio is larger than 100%
-                                            batchUpdatesFinal[i].insert({make_pair(ID1,ID2),tempSum});
-                                            existingUpdates[make_pair(ID1,ID2)]=tempSum;
-                                        }
-                                    }else if(tempChange<0){
-                                        if(tempChange > 20 || -tempChange/oldW > 0.5){//if the time change is larger than 20 seconds or the edge decrease ratio is larger than 50%
-                                            batchUpdatesFinal[i].insert({make_pair(ID1,ID2),tempSum});
-                                            existingUpdates[make_pair(ID1,ID2)]=tempSum;
-                                        }
-                                    }
-                                }
-
-                            }
-                        }
-
-                    }
-                    else{
-                        cout<<"Wrong. No edge "<<edgeID<<endl; exit(1);
-                    }
-                }
-
+            for(int i=0;i<batchUpdatesFinal.size();++i){
                 updateNum+=batchUpdatesFinal[i].size();
                 if(maxUpdateNum<batchUpdatesFinal[i].size()){
                     maxUpdateNum=batchUpdatesFinal[i].size();
@@ -756,39 +1028,26 @@ void GetBatchUpdatesLCCs(string graphFile, string edgeNodeFile, string edgeIDFil
                     minUpdateNum=batchUpdatesFinal[i].size();
                 }
             }
-            cout<<"Total update number: "<<updateNum<<" ; average update number: "<<updateNum/slotNum<<" ; maximum update number: "<<maxUpdateNum<<" ; minimum update number: "<<minUpdateNum<<endl;
+            log<<"Total update number: "<<updateNum<<" ; average update number: "<<updateNum/slotNum<<" ; maximum update number: "<<maxUpdateNum<<" ; minimum update number: "<<minUpdateNum<<endl;
 
             string outputFile=graphFile+"_"+ to_string(dayIDs[di])+"_"+to_string(batchInterval)+".batchUpdates";
-            ofstream OF1(outputFile+"Info", ios::out);
-            if (!OF1.is_open()) {
-                cout << "Open file failed!" << outputFile+"Info" << endl;
-                exit(1);
-            }
-            OF1<<slotNum<<endl;
-            for(int i=0;i<batchUpdatesFinal.size();++i){
-                OF1<<i<<" "<<batchUpdatesFinal[i].size()<<endl;
-            }
-            OF1.close();
-
-            ofstream OF(outputFile, ios::out);
-            if (!OF.is_open()) {
-                cout << "Open file failed!" << outputFile << endl;
-                exit(1);
-            }
-
-            OF<<slotNum<<" "<<batchInterval<<endl;
-            for(int i=0;i<batchUpdatesFinal.size();++i){
-                OF<<batchUpdatesFinal[i].size();
-                for(auto it=batchUpdatesFinal[i].begin();it!=batchUpdatesFinal[i].end();++it){
-                    ID1=it->first.first, ID2=it->first.second, weightT=it->second;
-                    OF<<" "<<ID1<<" "<<ID2<<" "<<weightT;
-
-                }
-                OF<<endl;
+            if(!WriteBatchUpdates(outputFile, slotNum, batchInterval, batchUpdatesFinal, log)){
+                jobLogs[k]=log.str();
+                return;
             }
-            OF.close();
+        }
+        jobLogs[k]=log.str();
+        jobDone[k]=1;
+    });
+    bool ifFailed=false;
+    for(int k=0;k<jobLogs.size();++k){
+        cout<<jobLogs[k];
+        if(!jobDone[k]){
+            cout<<"Batch updates of interval "<<batchIntervals[batchJobs[k].first]<<" s on "<<dayIDs[batchJobs[k].second]<<" failed!"<<endl;
+            ifFailed=true;
         }
     }
+    if(ifFailed) exit(1);
 
     tt.stop();
     cout<<"CPU elapsed time: "<<tt.GetRuntime()<<" s."<<endl;
@@ -814,22 +1073,9 @@ void GetEdgeUpdates(string graphFile, string edgeNodeFile, string edgeIDFile, st
         vector<map<unsigned long long int,int>> EdgeTrajectory;//new edge ID, time, edge weight
         vector<pair<int,int>> Edges;//new edge ID, distance, travel time
 
-        vector<string> carID;
-        vector<int> carType;//1: private car; 2: taxi; 0: others
-        vector<vector<long long int>> trajectory;
-        vector<vector<unsigned long long int>> trajectoryTime;
-        vector<vector<int>> trajectorySpeed;
-        vector<vector<int>> trajectoryCity;
-        vector<int> linkNum;
-        vector<int> travelDis, travelTime, travelSpeed;
-        vector<pair<double,double>> startPoint;//gps
-        vector<pair<double,double>> endPoint;//gps
-        vector<unsigned long long int> startTime, endTime;
+        TrajectoryBlock trips;//trajectories overlapping [startT, endT]
         int lineNum = 0;
         int tNum=0;
-        vector<unsigned long long int> traTemp;
-        vector<int> traTemp2;
-        vector<long long int> traTemp3;
 
         double lon, lat;
         int node_num, edge_num;
@@ -1004,107 +1250,38 @@ void GetEdgeUpdates(string graphFile, string edgeNodeFile, string edgeIDFile, st
         // read trajectory
         cout<<"Reading trajectories..."<<endl;
 
-        ifstream IF5(trajectoryFile, ios::in);
-        if (!IF5.is_open()) {
+        TrajectoryReader IF5;
+        if (!IF5.open(trajectoryFile)) {
             cout << "Open file failed!" << trajectoryFile << endl; exit(1);
         }
-
-        getline(IF5, line);
-        getline(IF5, line);
-        vs.clear();
-        boost::split(vs,line,boost::is_any_of(" "));
-//        vs=split(line,",");//link ID of trajectory
-        if (vs.size() != 1) {
-            cout << "Wrong syntax! " <<vs.size() <<" : "<< line << endl;
-            exit(1);
-        }
-        tNum= stoi(vs[0]);
+        tNum= IF5.tripNum;
         lineNum = 0;
         map<int,int> cityFreq;
+        TrajectoryBlock block;
 
-        while (getline(IF5, line)) {
-            if (line == "") continue;
-            vs.clear();
-            boost::split(vs,line,boost::is_any_of(" "));
-//        vs=split(line,",");//link ID of trajectory
-            if (vs.size() < 17) {
-                cout << "Wrong syntax! " <<vs.size() <<" : "<< line << endl;
-                exit(1);
-            }
-            if(stoll(vs[5])>endT || stoll(vs[6])<startT){
-                continue;
-            }
-
-//        lon=stod(vs[7]), lat=stod(vs[8]);
-//        lon=stod(vs[9]), lat=stod(vs[10]);
-            lineNum++;
-
-//        carID.emplace_back(vs[0]), carType.emplace_back(stoi(vs[1]));
-//        travelDis.emplace_back(stoi(vs[2])), travelTime.emplace_back(stoi(vs[3])), travelSpeed.emplace_back(stoi(vs[4]));
-            startTime.emplace_back(stoll(vs[5])), endTime.emplace_back(stoll(vs[6]));
-//        startPoint.emplace_back(stod(vs[7]),stod(vs[8]));
-//        endPoint.emplace_back(stod(vs[9]), stod(vs[10]));
-
-            int tempInt;
-            tempInt=stoi(vs[11]);
-            linkNum.emplace_back(tempInt);
-
-            int index_i=12;
-            traTemp3.clear();
-            for(int i=0;i<tempInt;++i){
-                traTemp3.push_back(stoll(vs[index_i]));
-                index_i++;
-            }
-            trajectory.emplace_back(traTemp3);
-
-
-            tempInt=stoi(vs[index_i]);
-            index_i++;
-            traTemp.clear();
-            for(int i=0;i<tempInt;++i){
-                traTemp.push_back(stoull(vs[index_i]));
-                index_i++;
-            }
-            trajectoryTime.emplace_back(traTemp);
-
-            tempInt=stoi(vs[index_i]);
-            index_i++;
-            traTemp2.clear();
-            for(int i=0;i<tempInt;++i){
-                traTemp2.push_back(stoi(vs[index_i]));
-                index_i++;
-            }
-            trajectorySpeed.emplace_back(traTemp2);
-
-            tempInt=stoi(vs[index_i]);
-            index_i++;
-            traTemp2.clear();
-            for(int i=0;i<tempInt;++i){
-                int temp=stoi(vs[index_i]);
-                traTemp2.push_back(temp);
-                index_i++;
-                if(cityFreq.find(temp)==cityFreq.end()){//if not found
-                    cityFreq.insert({temp,1});
-                }else{
-                    cityFreq[temp]++;
+        while (IF5.ReadBlock(block, startT, endT)) {//only the blocks overlapping [startT,endT] are read if the file is indexed
+            for(int bi=0;bi<block.size();++bi){
+                if(block.startTime[bi]>endT || block.endTime[bi]<startT){
+                    continue;
                 }
+                lineNum++;
+                trips.AddTrajectory(block,bi);
             }
-            trajectoryCity.emplace_back(traTemp2);
-
-//        cout<<tempInt<<":";
-//        for(int i=0; i<tempInt; ++i){
-//            cout<<" "<<traTemp2[i];
-//        }
-//        cout<<endl;
-
-
         }
         IF5.close();
-        if(lineNum!=trajectory.size()){
-            cout<<"Inconsistent trajectory number! "<<lineNum<<" "<<trajectory.size()<<" "<<tNum<<endl; exit(1);
+        if(lineNum!=trips.size()){
+            cout<<"Inconsistent trajectory number! "<<lineNum<<" "<<trips.size()<<" "<<tNum<<endl; exit(1);
+        }
+        for(int i=0;i<trips.linkCity.size();++i){
+            int temp=trips.linkCity[i];
+            if(cityFreq.find(temp)==cityFreq.end()){//if not found
+                cityFreq.insert({temp,1});
+            }else{
+                cityFreq[temp]++;
+            }
         }
 
-        cout << "Trajectory number: " << trajectory.size() <<" "<< trajectoryTime.size()<<" "<<trajectorySpeed.size()<<endl;
+        cout << "Trajectory number: " << trips.size() <<endl;
         cout<<"City number: "<<cityFreq.size()<<" . ";
         vector<pair<int,int>> cityFreqR;
         for(auto it=cityFreq.begin();it!=cityFreq.end();++it){
@@ -1117,23 +1294,25 @@ void GetEdgeUpdates(string graphFile, string edgeNodeFile, string edgeIDFile, st
         }
         cout<<endl;
         unsigned long long minTime=INT64_MAX, maxTime=0;
-        for(int i=0;i<trajectory.size();++i){
-            for(int j=0;j<trajectory[i].size();++j){
-                edgeID=trajectory[i][j];
+        for(int i=0;i<trips.size();++i){
+            int linkNum=trips.linkNum(i);
+            auto li=trips.linkOffset[i], ti=trips.timeOffset[i];
+            for(int j=0;j<linkNum;++j){
+                edgeID=trips.links[li+j];
                 if(edgeID<0){
                     edgeID=-edgeID;
                 }
 //            cout<<edgeID<<endl;
                 if(EdgeIDMap.find(edgeID) != EdgeIDMap.end()){//if found
                     edgeIDNew=EdgeIDMap[edgeID];
-                    timeStart=trajectoryTime[i][j];
+                    timeStart=trips.linkTime[ti+j];
                     if(timeStart<startT || timeStart>endT){
                         continue;
                     }
-                    if(j==trajectory[i].size()-1){
-                        weightT=endTime[i]-trajectoryTime[i][j];
+                    if(j==linkNum-1){
+                        weightT=trips.endTime[i]-trips.linkTime[ti+j];
                     }else{
-                        weightT=trajectoryTime[i][j+1]-trajectoryTime[i][j];
+                        weightT=trips.linkTime[ti+j+1]-trips.linkTime[ti+j];
                     }
                     if(weightT<1){
                         weightT=1;
@@ -1244,38 +1423,22 @@ void GetStreamUpdatesAndQueriesLCC(string graphFile, string edgeNodeFile, string
         map<long long int, int> EdgeIDMap;//map from old edge ID to new edge ID
         map<int, long long int> EdgeIDMapToOld;//map from new edge ID to old edge ID
         map<int, int> NodeIDMap;//map from new vertex ID to LCC vertex ID, only new vertex number
-        vector<map<unsigned long long int,int>> EdgeUpdates;//new edge ID (not LCC ID), time, edge weight
-        map<long long int, vector<pair<pair<int,int>, int>>> StreamUpdates;// time stamp, <ID1, ID2, weight>
+        vector<vector<tuple<unsigned long long int,long long int,int>>> EdgeUpdates;//new edge ID (not LCC ID), <time, weight sum, update count> sorted by time, the weight is the average
+        vector<StreamUpdate> StreamUpdates;//time stamp, ID1, ID2, weight; sorted by time stamp before writing
         vector<pair<int,int>> Edges;//new edge ID, distance, travel time of the LCC
         vector<pair<long long int,tuple<int,int,int,int>>> Queries;//store the queries generated by trajectories, <time stamp, <ID1,ID2,carType,trajectoryLength>>>
         vector<pair<double,double>> Coordinate;//coordinate of the LCC
 
-        vector<string> carID;
-        vector<int> carType;//1: private car; 2: taxi; 0: others
-        vector<vector<long long int>> trajectory;
-        vector<vector<unsigned long long int>> trajectoryTime;
-        vector<vector<int>> trajectorySpeed;
-        vector<vector<int>> trajectoryCity;
-        vector<int> linkNum;
-        vector<int> travelDis, travelTime, travelSpeed;
-        vector<pair<double,double>> startPoint;//gps
-        vector<pair<double,double>> endPoint;//gps
-        vector<unsigned long long int> startTime, endTime;
-        long long int startEdge, endEdge;
+        TrajectoryBlock trips;//trajectories overlapping [startT, endT]
 
         int lineNum = 0;
         int tNum=0;
-        vector<unsigned long long int> traTemp;
-        vector<int> traTemp2;
-        vector<long long int> traTemp3;
 
         double lon, lat;
         int node_num, edge_num;
         int edgeNumBefore;
         int ID1, ID2, weightD, weightT;
         long long int edgeID;
-        int edgeIDNew;
-        unsigned long long int timeStamp;
 
         cout<<"Reading edge ID map (from old edge ID to new edge ID)..."<<endl;
         /// edge ID map
@@ -1311,7 +1474,7 @@ void GetStreamUpdatesAndQueriesLCC(string graphFile, string edgeNodeFile, string
             cout<<"Inconsistent edge number. "<<EdgeIDMap.size() <<" "<< edgeNumBefore<<endl; exit(1);
         }
         Edges.assign(edgeNumBefore,pair<int,int>());
-        EdgeUpdates.assign(edgeNumBefore,map<unsigned long long int,int>());
+        EdgeUpdates.assign(edgeNumBefore,vector<tuple<unsigned long long int,long long int,int>>());
 
         cout<<"Reading node id map (from new vertex ID to LCC vertex ID)..."<<endl;
         /// node id map
@@ -1510,147 +1673,90 @@ void GetStreamUpdatesAndQueriesLCC(string graphFile, string edgeNodeFile, string
         // read trajectory
         cout<<"Reading trajectories..."<<endl;
 
-        ifstream IF5(trajectoryFile, ios::in);
-        if (!IF5.is_open()) {
+        TrajectoryReader IF5;
+        if (!IF5.open(trajectoryFile)) {
             cout << "Open file failed!" << trajectoryFile << endl; exit(1);
         }
-
-        getline(IF5, line);
-        getline(IF5, line);
-        vs.clear();
-        boost::split(vs,line,boost::is_any_of(" "));
-//        vs=split(line,",");//link ID of trajectory
-        if (vs.size() != 1) {
-            cout << "Wrong syntax! " <<vs.size() <<" : "<< line << endl;
-            exit(1);
-        }
-        tNum= stoi(vs[0]);
+        tNum= IF5.tripNum;
         lineNum = 0;
         map<int,int> cityFreq;
+        TrajectoryBlock block;
 
-        while (getline(IF5, line)) {
-            if (line == "") continue;
-            vs.clear();
-            boost::split(vs,line,boost::is_any_of(" "));
-//        vs=split(line,",");//link ID of trajectory
-            if (vs.size() < 17) {
-                cout << "Wrong syntax! " <<vs.size() <<" : "<< line << endl;
-                exit(1);
-            }
-            if(stoll(vs[5])>endT || stoll(vs[6])<startT){
-                continue;
+        while (IF5.ReadBlock(block, startT, endT)) {//only the blocks overlapping [startT,endT] are read if the file is indexed
+            for(int bi=0;bi<block.size();++bi){
+                if(block.startTime[bi]>endT || block.endTime[bi]<startT){
+                    continue;
+                }
+                lineNum++;
+                trips.AddTrajectory(block,bi);
             }
-
-//        lon=stod(vs[7]), lat=stod(vs[8]);
-//        lon=stod(vs[9]), lat=stod(vs[10]);
-            lineNum++;
-
-//        carID.emplace_back(vs[0]), carType.emplace_back(stoi(vs[1]));
-//        travelDis.emplace_back(stoi(vs[2])), travelTime.emplace_back(stoi(vs[3])), travelSpeed.emplace_back(stoi(vs[4]));
-            startTime.emplace_back(stoll(vs[5])), endTime.emplace_back(stoll(vs[6]));
-            startPoint.emplace_back(stod(vs[7]),stod(vs[8]));
-            endPoint.emplace_back(stod(vs[9]), stod(vs[10]));
-
-            int tempInt;
-            tempInt=stoi(vs[11]);
-            linkNum.emplace_back(tempInt);
-
-            int index_i=12;
-            traTemp3.clear();
-            for(int i=0;i<tempInt;++i){
-                traTemp3.push_back(stoll(vs[index_i]));
-                index_i++;
-            }
-            trajectory.emplace_back(traTemp3);
-            startEdge=traTemp3[0];
-            endEdge=traTemp3[traTemp3.size()-1];
-
-            if(startEdge<0) startEdge=-startEdge;
-            if(endEdge<0) endEdge=-endEdge;
-
-            if(stoll(vs[5]) >= startT && stoll(vs[5]) < endT){
-                if(EdgeToNodeMap.find(startEdge)!=EdgeToNodeMap.end() && EdgeToNodeMap.find(endEdge)!=EdgeToNodeMap.end()){//if found
-                    ID1=EdgeToNodeMap[startEdge].first, ID2=EdgeToNodeMap[startEdge].second;//the vertex id of start edge
-                    double dis1= EuclideanDis(Coordinate[ID1],startPoint[startPoint.size()-1]);
-                    double dis2= EuclideanDis(Coordinate[ID2],startPoint[startPoint.size()-1]);
-                    pair<int,int> query;
-
-                    if(dis1<=dis2){//check which endpoint of start edge is closer to the start point
-                        query.first=ID1;
-                        if(dis1>100){
-                            cout<<"seems wrong. "<<ID1<<" "<<dis2<<" "<<dis1<<endl; exit(1);
-                        }
-                    }else{
-                        query.first=ID2;
-                        if(dis2>100){
-                            cout<<"seems wrong. "<<ID2<<" "<<dis1<<" "<<dis2<<endl; exit(1);
-                        }
-                    }
-                    ID1=EdgeToNodeMap[endEdge].first, ID2=EdgeToNodeMap[endEdge].second;
-                    dis1= EuclideanDis(Coordinate[ID1],endPoint[endPoint.size()-1]);
-                    dis2= EuclideanDis(Coordinate[ID2],endPoint[endPoint.size()-1]);
-                    if(dis1<=dis2){
-                        query.second=ID1;
-                        if(dis1>100){
-                            cout<<"seems wrong. "<<ID1<<" "<<dis2<<" "<<dis1<<endl; exit(1);
-                        }
-                    }else{
-                        query.second=ID2;
-                        if(dis2>100){
-                            cout<<"seems wrong. "<<ID2<<" "<<dis1<<" "<<dis2<<endl; exit(1);
+        }
+        IF5.close();
+        if(lineNum!=trips.size()){
+            cout<<"Inconsistent trajectory number! "<<lineNum<<" "<<trips.size()<<" "<<tNum<<endl; exit(1);
+        }
+
+        // dense LCC edges: old edge IDs sorted, with their LCC endpoints and new edge IDs, so that the links are resolved once by binary search
+        vector<long long int> lccEdgeIDs;//old edge ID
+        vector<pair<int,int>> lccEdgeNode;//LCC vertex IDs of the endpoints
+        vector<int> lccEdgeNew;//new edge ID, -1 if not in EdgeIDMap
+        lccEdgeIDs.reserve(EdgeToNodeMap.size()); lccEdgeNode.reserve(EdgeToNodeMap.size()); lccEdgeNew.reserve(EdgeToNodeMap.size());
+        for(auto it=EdgeToNodeMap.begin();it!=EdgeToNodeMap.end();++it){//increasing old edge ID
+            lccEdgeIDs.emplace_back(it->first);
+            lccEdgeNode.emplace_back(it->second);
+            auto itID=EdgeIDMap.find(it->first);
+            lccEdgeNew.emplace_back(itID==EdgeIDMap.end()?-1:itID->second);
+        }
+        vector<int> tripLCCEdge(trips.links.size());//position of each trajectory link in lccEdgeIDs, -1 if not in the LCC
+        for(size_t k=0;k<trips.links.size();++k){
+            tripLCCEdge[k]=DenseIndex(lccEdgeIDs, trips.links[k]<0?-trips.links[k]:trips.links[k]);
+        }
+
+        // queries: the endpoint of the first (last) LCC link closer to the start (end) point; if it is too far, the point is snapped to the nearest LCC vertex
+        VertexGrid vertexGrid;
+        vertexGrid.Build(Coordinate);
+        int queryChunkNum=threadNum>1 ? max<int>(1,min<int>(trips.size(),threadNum*4)) : 1;
+        vector<vector<pair<long long int,tuple<int,int,int,int>>>> chunkQueries(queryChunkNum);
+        vector<int> chunkSnapNum(queryChunkNum,0), chunkSkipNum(queryChunkNum,0);
+        ParallelFor(queryChunkNum, threadNum, [&](int c){
+            int tripBegin=trips.size()*c/queryChunkNum, tripEnd=trips.size()*(c+1)/queryChunkNum;
+            for(int i=tripBegin;i<tripEnd;++i){
+                if(trips.linkNum(i)==0) continue;
+                int startIndex=tripLCCEdge[trips.linkOffset[i]];
+                int endIndex=tripLCCEdge[trips.linkOffset[i+1]-1];
+
+                if(trips.startTime[i] >= startT && trips.startTime[i] < endT){
+                    if(startIndex>=0 && endIndex>=0){//if found
+                        pair<int,int> query;
+                        query.first=QueryVertex(lccEdgeNode[startIndex], trips.startPoint[i], Coordinate, vertexGrid, chunkSnapNum[c]);
+                        query.second=QueryVertex(lccEdgeNode[endIndex], trips.endPoint[i], Coordinate, vertexGrid, chunkSnapNum[c]);
+                        if(query.first<0 || query.second<0){//no LCC vertex near the start or end point
+                            chunkSkipNum[c]++;
+                            continue;
                         }
+                        chunkQueries[c].emplace_back(trips.startTime[i],make_tuple(query.first, query.second, trips.carType[i], trips.travelDis[i]));//obtain queries
                     }
-                    Queries.emplace_back(stoll(vs[5]),make_tuple(query.first, query.second, stoi(vs[1]), stoi(vs[2])));//obtain queries
-                }
-            }
-
-            tempInt=stoi(vs[index_i]);
-            index_i++;
-            traTemp.clear();
-            for(int i=0;i<tempInt;++i){
-                traTemp.push_back(stoull(vs[index_i]));
-                index_i++;
-            }
-            trajectoryTime.emplace_back(traTemp);
-
-            tempInt=stoi(vs[index_i]);
-            index_i++;
-            traTemp2.clear();
-            for(int i=0;i<tempInt;++i){
-                traTemp2.push_back(stoi(vs[index_i]));
-                index_i++;
-            }
-            trajectorySpeed.emplace_back(traTemp2);
-
-            tempInt=stoi(vs[index_i]);
-            index_i++;
-            traTemp2.clear();
-            for(int i=0;i<tempInt;++i){
-                int temp=stoi(vs[index_i]);
-                traTemp2.push_back(temp);
-                index_i++;
-                if(cityFreq.find(temp)==cityFreq.end()){//if not found
-                    cityFreq.insert({temp,1});
-                }else{
-                    cityFreq[temp]++;
                 }
             }
-            trajectoryCity.emplace_back(traTemp2);
-
-//        cout<<tempInt<<":";
-//        for(int i=0; i<tempInt; ++i){
-//            cout<<" "<<traTemp2[i];
-//        }
-//        cout<<endl;
-
-
+        });
+        int snapNum=0, skipNum=0;
+        for(int c=0;c<queryChunkNum;++c){
+            Queries.insert(Queries.end(), chunkQueries[c].begin(), chunkQueries[c].end());
+            snapNum+=chunkSnapNum[c], skipNum+=chunkSkipNum[c];
         }
-        IF5.close();
-        if(lineNum!=trajectory.size()){
-            cout<<"Inconsistent trajectory number! "<<lineNum<<" "<<trajectory.size()<<" "<<tNum<<endl; exit(1);
+        if(snapNum>0 || skipNum>0){
+            cout<<"Query endpoints snapped to the nearest vertex: "<<snapNum<<" ; trajectories without query (no vertex within "<<querySnapDis<<"): "<<skipNum<<endl;
+        }
+        for(int i=0;i<trips.linkCity.size();++i){
+            int temp=trips.linkCity[i];
+            if(cityFreq.find(temp)==cityFreq.end()){//if not found
+                cityFreq.insert({temp,1});
+            }else{
+                cityFreq[temp]++;
+            }
         }
 
-        cout << "Trajectory number: " << trajectory.size() <<" "<< trajectoryTime.size()<<" "<<trajectorySpeed.size()<<endl;
+        cout << "Trajectory number: " << trips.size() <<endl;
         cout << "Query number: "<<Queries.size()<<endl;
         cout<<"City number: "<<cityFreq.size()<<" . ";
         vector<pair<int,int>> cityFreqR;
@@ -1664,78 +1770,121 @@ void GetStreamUpdatesAndQueriesLCC(string graphFile, string edgeNodeFile, string
         }
         cout<<endl;
         unsigned long long minTime=INT64_MAX, maxTime=0;
-        map<pair<int,long long int>,int> residualEdgeInfo;//map from <edgeID, time stamp> to its count number
-        for(int i=0;i<trajectory.size();++i){
-            for(int j=0;j<trajectory[i].size();++j){
-                edgeID=trajectory[i][j];
-                if(edgeID<0){
-                    edgeID=-edgeID;
-                }
-//            cout<<edgeID<<endl;
-                if(EdgeToNodeMap.find(edgeID) != EdgeToNodeMap.end()) {//if found, means that edgeID is in LCC
-                    if (EdgeIDMap.find(edgeID) != EdgeIDMap.end()) {//if found, old
-                        edgeIDNew = EdgeIDMap[edgeID];
-                        timeStamp = trajectoryTime[i][j];
-                        if (timeStamp < startT || timeStamp > endT) {
-                            continue;
-                        }
-                        if (j == trajectory[i].size() - 1) {
-                            weightT = endTime[i] - trajectoryTime[i][j];
-                        } else {
-                            weightT = trajectoryTime[i][j + 1] - trajectoryTime[i][j];
-                        }
-
-                        int originalW = Edges[edgeIDNew].second;
-                        double tempW = 0.83 * originalW;
-                        if (weightT < tempW) {//if exceeds the speed limit over 20%
-                            weightT = tempW;
-                        }
-                        weightD = Edges[edgeIDNew].first;
-                        double minW = ceil((double) weightD / 33.33);//120km/h
-                        if (weightT < minW) {
-                            weightT = minW;
-                        }
-                        if (weightT < 1) {
-                            if (EdgeToNodeMap.find(edgeID) != EdgeToNodeMap.end()) {//if found
-                                cout << "wrong time. " << EdgeToNodeMap[edgeID].first << " "
-                                     << EdgeToNodeMap[edgeID].second << " : " << weightT << " " << weightD << " " << i
-                                     << " " << j << endl;
-                                exit(1);
+        // derive the updates of each chunk of trajectories in parallel, the updates are bucketed by new edge ID % partNum and kept in trajectory order
+        int chunkNum=threadNum>1 ? max<int>(1,min<int>(trips.size(),threadNum*4)) : 1;
+        int partNum=threadNum;
+        vector<vector<vector<tuple<int,unsigned long long int,int>>>> chunkUpdates(chunkNum, vector<vector<tuple<int,unsigned long long int,int>>>(partNum));//new edge ID, time stamp, weight
+        vector<vector<StreamUpdate>> chunkStreamUpdates(chunkNum);//stream updates of each chunk, in trajectory order
+        vector<string> chunkErrors(chunkNum);//error of each chunk, reported after the workers finish
+        atomic<bool> ifFailed(false);//the other chunks stop once one chunk fails
+        ParallelFor(chunkNum, threadNum, [&](int c){
+            long long int edgeID;
+            int edgeIDNew, weightD, weightT;
+            unsigned long long int timeStamp;
+            int tripBegin=trips.size()*c/chunkNum, tripEnd=trips.size()*(c+1)/chunkNum;
+            for(int i=tripBegin;i<tripEnd && !ifFailed;++i){
+                int linkNum=trips.linkNum(i);
+                auto li=trips.linkOffset[i], ti=trips.timeOffset[i];
+                for(int j=0;j<linkNum;++j){
+                    int lccIndex=tripLCCEdge[li+j];
+//                cout<<edgeID<<endl;
+                    if(lccIndex>=0) {//if found, means that edgeID is in LCC
+                        edgeID=lccEdgeIDs[lccIndex];
+                        if (lccEdgeNew[lccIndex]>=0) {//if found, old
+                            edgeIDNew = lccEdgeNew[lccIndex];
+                            timeStamp = trips.linkTime[ti + j];
+                            if (timeStamp < startT || timeStamp > endT) {
+                                continue;
+                            }
+                            if (j == linkNum - 1) {
+                                weightT = trips.endTime[i] - trips.linkTime[ti + j];
                             } else {
-                                cout << "wrong time. not found edgeID " << edgeID << " : " << weightT << " " << weightD
-                                     << " " << i << " " << j << endl;
-                                exit(1);
+                                weightT = trips.linkTime[ti + j + 1] - trips.linkTime[ti + j];
                             }
-                        }
-                        if (EdgeUpdates[edgeIDNew].find(timeStamp) == EdgeUpdates[edgeIDNew].end()) {//if not found
-                            EdgeUpdates[edgeIDNew].insert({timeStamp, weightT});
-                        } else {//if found
-                            if (residualEdgeInfo.find(make_pair(edgeIDNew, timeStamp)) ==
-                                residualEdgeInfo.end()) {//if not found
-                                residualEdgeInfo.insert({make_pair(edgeIDNew, timeStamp), 2});
-                                EdgeUpdates[edgeIDNew][timeStamp] += weightT;
-                                EdgeUpdates[edgeIDNew][timeStamp] /= 2;
-                            } else {//if found
-                                EdgeUpdates[edgeIDNew][timeStamp] *= residualEdgeInfo[make_pair(edgeIDNew, timeStamp)];
-                                EdgeUpdates[edgeIDNew][timeStamp] += weightT;
-                                residualEdgeInfo[make_pair(edgeIDNew, timeStamp)] += 1;
-                                EdgeUpdates[edgeIDNew][timeStamp] /= residualEdgeInfo[make_pair(edgeIDNew, timeStamp)];
+
+                            int originalW = Edges[edgeIDNew].second;
+                            double tempW = 0.83 * originalW;
+                            if (weightT < tempW) {//if exceeds the speed limit over 20%
+                                weightT = tempW;
+                            }
+                            weightD = Edges[edgeIDNew].first;
+                            double minW = ceil((double) weightD / 33.33);//120km/h
+                            if (weightT < minW) {
+                                weightT = minW;
                             }
+                            if (weightT < 1) {
+                                stringstream error;
+                                error << "wrong time. " << lccEdgeNode[lccIndex].first << " "
+                                     << lccEdgeNode[lccIndex].second << " : " << weightT << " " << weightD << " " << i
+                                     << " " << j;
+                                chunkErrors[c]=error.str();
+                                ifFailed=true;
+                                return;
+                            }
+                            chunkUpdates[c][edgeIDNew%partNum].emplace_back(edgeIDNew, timeStamp, weightT);
+                            chunkStreamUpdates[c].push_back({timeStamp, lccEdgeNode[lccIndex].first, lccEdgeNode[lccIndex].second, weightT});
+                        }
+                        else{
+                            chunkErrors[c]="Not found in EdgeIDMap "+to_string(edgeID);
+                            ifFailed=true;
+                            return;
                         }
-                        StreamUpdates[timeStamp].emplace_back(EdgeToNodeMap[edgeID], weightT);
-                        if (minTime > timeStamp) minTime = timeStamp;
-                        if (maxTime < timeStamp) maxTime = timeStamp;
                     }
                     else{
-                        cout<<"Not found in EdgeIDMap "<<edgeID<<endl; exit(1);
+//                    cout<<"Not found!"<<endl; exit(1);
                     }
                 }
-                else{
-//                cout<<"Not found!"<<endl; exit(1);
+            }
+        });
+        if(ifFailed){
+            for(int c=0;c<chunkNum;++c){//the first error in trajectory order
+                if(!chunkErrors[c].empty()){
+                    cout<<chunkErrors[c]<<endl; exit(1);
                 }
             }
         }
-        cout<<"Repeated edge update number: "<<residualEdgeInfo.size()<<endl;
+        // accumulate the updates of each edge as <time, weight sum, count>, each part of the edges is done by one thread
+        vector<long long int> partRepeatNum(partNum,0);
+        ParallelFor(partNum, threadNum, [&](int p){
+            for(int c=0;c<chunkNum;++c){
+                for(auto& update: chunkUpdates[c][p]){
+                    EdgeUpdates[get<0>(update)].emplace_back(get<1>(update), get<2>(update), 1);
+                }
+                vector<tuple<int,unsigned long long int,int>>().swap(chunkUpdates[c][p]);
+            }
+            for(int i=p;i<EdgeUpdates.size();i+=partNum){//merge the updates of the same time stamp
+                vector<tuple<unsigned long long int,long long int,int>>& updates=EdgeUpdates[i];
+                if(updates.empty()) continue;
+                sort(updates.begin(), updates.end());
+                int k=0;
+                for(int j=1;j<updates.size();++j){
+                    if(get<0>(updates[j])==get<0>(updates[k])){
+                        if(get<2>(updates[k])==1) partRepeatNum[p]++;
+                        get<1>(updates[k])+=get<1>(updates[j]);
+                        get<2>(updates[k])+=1;
+                    }else{
+                        updates[++k]=updates[j];
+                    }
+                }
+                updates.resize(k+1);
+            }
+        });
+        // concatenate the stream updates in chunk order (the serial order), then sort them by time stamp; the sort is stable so the order within a time stamp is kept
+        size_t streamUpdateNum=0;
+        for(int c=0;c<chunkNum;++c) streamUpdateNum+=chunkStreamUpdates[c].size();
+        StreamUpdates.reserve(streamUpdateNum);
+        for(int c=0;c<chunkNum;++c){
+            for(auto& update: chunkStreamUpdates[c]){
+                if (minTime > update.time) minTime = update.time;
+                if (maxTime < update.time) maxTime = update.time;
+            }
+            StreamUpdates.insert(StreamUpdates.end(), chunkStreamUpdates[c].begin(), chunkStreamUpdates[c].end());
+            vector<StreamUpdate>().swap(chunkStreamUpdates[c]);
+        }
+        RadixSort(StreamUpdates, [](const StreamUpdate& u){ return u.time; });
+        long long int repeatNum=0;
+        for(int p=0;p<partNum;++p) repeatNum+=partRepeatNum[p];
+        cout<<"Repeated edge update number: "<<repeatNum<<endl;
         cout<<"Time range: [ "<<minTime<<" "<<maxTime<<" ] , equals to "<<(double)(maxTime-minTime)/(60*60)<<" hours."<<endl;
 
         ifstream IFOut1(graphFile+".edgeUpdates");
@@ -1768,13 +1917,14 @@ void GetStreamUpdatesAndQueriesLCC(string graphFile, string edgeNodeFile, string
                     OF<< EdgeToNodeMap[EdgeIDMapToOld[i]].first<<" "<<EdgeToNodeMap[EdgeIDMapToOld[i]].second<<" "<<Edges[i].first<<" "<<Edges[i].second<<" " <<EdgeUpdates[i].size();//original edge distance and time, edge update size
                     edgeUpdateNum+=EdgeUpdates[i].size();
                     for(auto it=EdgeUpdates[i].begin();it!=EdgeUpdates[i].end();++it){
+                        int weight=get<1>(*it)/get<2>(*it);//average of the updates at this time stamp
                         int w1=Edges[i].second*0.83, w2=Edges[i].first/33.3;
-                        if(it->second<w1 && it->second<w2){
-                            cout<<"Invalid update "<<i<<" "<<EdgeIDMapToOld[i]<<" "<<EdgeToNodeMap[EdgeIDMapToOld[i]].first<<" "<<EdgeToNodeMap[EdgeIDMapToOld[i]].second<<" "<<Edges[i].first<<"("<<w2<<") "<<Edges[i].second<<"("<<w1<<") "<<it->second<<endl;
-                            it->second=max(w1, w2);
+                        if(weight<w1 && weight<w2){
+                            cout<<"Invalid update "<<i<<" "<<EdgeIDMapToOld[i]<<" "<<EdgeToNodeMap[EdgeIDMapToOld[i]].first<<" "<<EdgeToNodeMap[EdgeIDMapToOld[i]].second<<" "<<Edges[i].first<<"("<<w2<<") "<<Edges[i].second<<"("<<w1<<") "<<weight<<endl;
+                            weight=max(w1, w2);
 //                            exit(1);
                         }
-                        OF<<" "<<it->first<<" "<<it->second;//update time and edge weight
+                        OF<<" "<<get<0>(*it)<<" "<<weight;//update time and edge weight
                     }
                     OF<<endl;
                 }
@@ -1800,17 +1950,22 @@ void GetStreamUpdatesAndQueriesLCC(string graphFile, string edgeNodeFile, string
                 cout << "Open file failed!" << graphFile+".streamUpdates" << endl;
                 exit(1);
             }
-            OF2<<StreamUpdates.size()<<endl;//time stamp number
-            for(auto it=StreamUpdates.begin();it!=StreamUpdates.end();++it) {
-                OF2 << it->first << " " << it->second.size();
-                for (int i = 0; i < it->second.size(); ++i) {
-                    OF2<<" "<<it->second[i].first.first << " " << it->second[i].first.second << " "<< it->second[i].second;// ID1, ID2, weight
+            int timeNum=0;
+            for(size_t i=0;i<StreamUpdates.size();++i){
+                if(i==0 || StreamUpdates[i].time!=StreamUpdates[i-1].time) timeNum++;
+            }
+            OF2<<timeNum<<endl;//time stamp number
+            for(size_t i=0, j;i<StreamUpdates.size();i=j) {//one line per time stamp
+                for(j=i;j<StreamUpdates.size() && StreamUpdates[j].time==StreamUpdates[i].time;++j);
+                OF2 << StreamUpdates[i].time << " " << j-i;
+                for (size_t k = i; k < j; ++k) {
+                    OF2<<" "<<StreamUpdates[k].ID1 << " " << StreamUpdates[k].ID2 << " "<< StreamUpdates[k].weight;// ID1, ID2, weight
                 }
-                OF2<<endl;
+                OF2<<"\n";
             }
             OF2.close();
             tt.stop();
-            cout<<"Stream update number: "<<StreamUpdates.size()<<endl;
+            cout<<"Stream update number: "<<timeNum<<endl;
         }
 
 
@@ -1835,20 +1990,24 @@ void GetStreamUpdatesAndQueriesLCC(string graphFile, string edgeNodeFile, string
 
 }
 
-//function of getting target trajectories of certain GPS range
-void GetTargetTrajectory(vector<string> sourceFiles, string outputFile, pair<double,double> lonP, pair<double,double> latP) {
-    ifstream IFOut(outputFile);
-    if(IFOut.is_open()){//if exist
+//function of getting target trajectories of certain GPS ranges, the regions whose output does not exist are extracted in one pass over the source files
+void GetTargetTrajectory(vector<string> sourceFiles, vector<TargetRegion>& regions) {
+    vector<int> pending;//regions to extract
+    for(int ri=0;ri<regions.size();++ri){
+        string outputFile=regions[ri].outputFile;
+        ifstream IFOut(outputFile);
+        if(!IFOut.is_open()){//if not exist
+            pending.push_back(ri);
+            continue;
+        }
         cout<<"File "<<outputFile<<" already exist."<<endl;
         IFOut.close();
 //        cout<<"Reading trajectories..."<<endl;
 
-        ifstream IF5(outputFile, ios::in);
-        if (!IF5.is_open()) {
+        TrajectoryReader IF5;
+        if (!IF5.open(outputFile)) {
             cout << "Open file failed!" << outputFile << endl; exit(1);
         }
-        string line;
-        vector<string> vs;
         vector<int> dayIDs;
         dayIDs.emplace_back(20160101); dayIDs.emplace_back(20160102); dayIDs.emplace_back(20160103); dayIDs.emplace_back(20160104);dayIDs.emplace_back(20160105);
         vector<pair<unsigned long long int, unsigned long long int>> dayIntervals;
@@ -1856,241 +2015,473 @@ void GetTargetTrajectory(vector<string> sourceFiles, string outputFile, pair<dou
         dayIntervals.emplace_back(1451750400,1451836800); dayIntervals.emplace_back(1451836800,1451923200);
         dayIntervals.emplace_back(1451923200,1452009600);
 
-        getline(IF5, line);
-        getline(IF5, line);
-        vs.clear();
-        boost::split(vs,line,boost::is_any_of(" "));
-//        vs=split(line,",");//link ID of trajectory
-        if (vs.size() != 1) {
-            cout << "Wrong syntax! " <<vs.size() <<" : "<< line << endl;
-            exit(1);
-        }
-        int tNum= stoi(vs[0]);
-        int lineNum = 0;
+        int lineNum = IF5.tripNum;
         vector<int> tNumPerDay(5,0);
         long long int startT, endT;
-        while (getline(IF5, line)) {
-            if (line == "") continue;
-            vs.clear();
-            boost::split(vs,line,boost::is_any_of(" "));
-//        vs=split(line,",");//link ID of trajectory
-            if (vs.size() < 17) {
-                cout << "Wrong syntax! " <<vs.size() <<" : "<< line << endl;
-                exit(1);
-            }
-            startT=stoll(vs[5]);
-            endT=stoll(vs[6]);
-            if((startT >= dayIntervals[4].first && startT < dayIntervals[4].second) || (endT >= dayIntervals[4].first && endT < dayIntervals[4].second)){
-                tNumPerDay[4]++;
+        TrajectoryBlock block;
+        while (IF5.ReadBlock(block, dayIntervals[4].first, dayIntervals[4].second-1)) {
+            for(int i=0;i<block.size();++i){
+                startT=block.startTime[i];
+                endT=block.endTime[i];
+                if((startT >= dayIntervals[4].first && startT < dayIntervals[4].second) || (endT >= dayIntervals[4].first && endT < dayIntervals[4].second)){
+                    tNumPerDay[4]++;
+                }
             }
-
-//        lon=stod(vs[7]), lat=stod(vs[8]);
-//        lon=stod(vs[9]), lat=stod(vs[10]);
-            lineNum++;
-
-
         }
         IF5.close();
 
         cout << "Overall trajectory number: " << lineNum <<" ; trajectory of day 5: "<< tNumPerDay[4]<<endl;
 //        exit(0);
-
     }
-    else{//if not exist
-        cout<<"Longitude range: "<< lonP.first<<" "<<lonP.second<<" ; Latitude range: "<<latP.first<<" "<<latP.second<<endl;
-        IFOut.close();
-        Timer tt;
-        tt.start();
-        vector<string> vs;
-        string line;
-        long long int EdgeID;
-        unsigned long long int TimeID;//Time to 1970, unit: s
-        vector<string> carID;
-        vector<int> carType;//1: private car; 2: taxi; 0: others
-        vector<vector<long long int>> trajectory;
-        vector<vector<unsigned long long int>> trajectoryTime;
-        vector<vector<int>> trajectorySpeed;
-        vector<vector<int>> trajectoryCity;
-        vector<int> linkNum;
-        vector<int> travelDis, travelTime, travelSpeed;
-        vector<pair<double,double>> startPoint;//gps
-        vector<pair<double,double>> endPoint;//gps
-        vector<unsigned long long int> startTime, endTime;
-        int lineNum = 0;
-        int tNum=0;
-        vector<unsigned long long int> traTemp;
-        vector<int> traTemp2;
-        vector<long long int> traTemp3;
+    if(pending.empty()) return;
 
-        unsigned long long int minTime=INT64_MAX, maxTime=0;
-        double minLon=INT16_MAX, minLat=INT16_MAX;
-        double maxLon=-INT16_MAX, maxLat=-INT16_MAX;
-        double lon, lat;
+    Timer tt;
+    tt.start();
+    int lineNum = 0;
+    TrajectoryBlock block;
+    TrajectoryGrid grid;
+    vector<unsigned int> candidates, regionCandidates;//ordinal numbers of the trajectories in the cells overlapping the target areas
+    int gridFileNum=0;
+    long long int candidateNum=0;
+
+    for(int pi=0;pi<pending.size();++pi){
+        TargetRegion& region=regions[pending[pi]];
+        region.trips.clear();
+        cout<<"Target "<<region.outputFile<<" Longitude range: "<< region.lonP.first<<" "<<region.lonP.second<<" ; Latitude range: "<<region.latP.first<<" "<<region.latP.second<<endl;
+    }
+    cout<<"Reading trajectories..."<<endl;
 
-        cout<<"Target Longitude range: "<< lonP.first<<" "<<lonP.second<<" ; Latitude range: "<<latP.first<<" "<<latP.second<<endl;
-        cout<<"Reading trajectories..."<<endl;
 
+    for(int fi=0;fi<sourceFiles.size();++fi){
+        string sourceFile=sourceFiles[fi];
+        TrajectoryReader IF;
+        if (!IF.open(sourceFile)) {
+            cout << "Open file failed!" << sourceFile << endl;
+            continue;
+        }
+        lineNum = 0;
 
-        for(int fi=0;fi<sourceFiles.size();++fi){
-            string sourceFile=sourceFiles[fi];
-            ifstream IF(sourceFile, ios::in);
-            if (!IF.is_open()) {
-                cout << "Open file failed!" << sourceFile << endl;
-                continue;
+        if(IF.ifIndex && grid.Read(sourceFile+".grid") && grid.tripNum==IF.tripNum){//only read the blocks of the trajectories in the candidate cells
+            candidates.clear();
+            for(int pi=0;pi<pending.size();++pi){
+                grid.Candidates(regions[pending[pi]].lonP, regions[pending[pi]].latP, regionCandidates);
+                candidates.insert(candidates.end(), regionCandidates.begin(), regionCandidates.end());
+            }
+            if(pending.size()>1){
+                sort(candidates.begin(), candidates.end());
+                candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+            }
+            gridFileNum++;
+            candidateNum+=candidates.size();
+            for(int ci=0;ci<candidates.size();){
+                int bi=candidates[ci]/trajectoryBlockSize;
+                IF.ReadBlockAt(block, bi);
+                for(;ci<candidates.size() && candidates[ci]/trajectoryBlockSize==bi;++ci){
+                    int i=candidates[ci]%trajectoryBlockSize;
+                    if(i>=block.size()){
+                        cout<<"Wrong grid file! "<<sourceFile+".grid"<<" "<<candidates[ci]<<endl; exit(1);
+                    }
+                    for(int pi=0;pi<pending.size();++pi){
+                        regions[pending[pi]].Add(block,i);
+                    }
+                }
             }
+            IF.close();
+            continue;
+        }
 
-            getline(IF, line);
-            getline(IF, line);
-            vs.clear();
-            boost::split(vs,line,boost::is_any_of(" "));
-//        vs=split(line,",");//link ID of trajectory
-            if (vs.size() != 1) {
-                cout << "Wrong syntax! " <<vs.size() <<" : "<< line << endl;
-                exit(1);
+        while (IF.ReadBlock(block)) {
+            for(int i=0;i<block.size();++i){
+                lineNum++;
+                for(int pi=0;pi<pending.size();++pi){
+                    regions[pending[pi]].Add(block,i);
+                }
             }
-            tNum= stoi(vs[0]);
-            bool flagFind=false;
-            lineNum = 0;
+        }
+        IF.close();
+        if(lineNum!=IF.tripNum){
+            cout<<"Inconsistent trajectory number! "<<lineNum<<" "<<IF.tripNum<<endl; exit(1);
+        }
+//        cout<<"File "<<fi<<" done."<< endl;
+    }
+    cout<<"Files read by the spatial grid: "<<gridFileNum<<" / "<<sourceFiles.size()<<" ; candidate trajectory number: "<<candidateNum<<endl;
+
+    for(int pi=0;pi<pending.size();++pi){
+        TargetRegion& region=regions[pending[pi]];
+        string outputFile=region.outputFile;
+        TrajectoryBlock& targets=region.trips;
+        // sort by start time so that a time range only touches the blocks of its index entries
+        vector<int> order(targets.size());
+        for(int i=0;i<order.size();++i) order[i]=i;
+        stable_sort(order.begin(), order.end(), [&targets](int a, int b){
+            return targets.startTime[a]<targets.startTime[b];
+        });
+        TrajectoryWriter OF;
+        if (!OF.open(outputFile+".tmp", trajectoryFormat, true)) {
+            cout << "Open file failed!" << outputFile+".tmp" << endl;
+            exit(1);
+        }
+        for(int i=0;i<order.size();++i){
+            OF.Write(targets,order[i]);
+        }
+        if(!OF.close()){
+            cout << "Write file failed!" << outputFile+".tmp.index" << endl;
+            exit(1);
+        }
+        if(rename((outputFile+".tmp.index").c_str(), (outputFile+".index").c_str())!=0 || rename((outputFile+".tmp").c_str(), outputFile.c_str())!=0){
+            cout << "Rename file failed!" << outputFile << endl;
+            exit(1);
+        }
 
-            while (getline(IF, line)) {
-                if (line == "") continue;
-                vs.clear();
-                boost::split(vs,line,boost::is_any_of(" "));
-//        vs=split(line,",");//link ID of trajectory
-                if (vs.size() < 17) {
-                    cout << "Wrong syntax! " <<vs.size() <<" : "<< line << endl;
-                    exit(1);
-                }
+        cout << outputFile<<" trajectory number: " << OF.tripNum << " ; Time range: [ "<< region.minTime <<" "<<region.maxTime<<" ] s; GPS range: [ "<< region.minLon<<" "<<region.maxLon<<" ] [ "<<region.minLat<<" "<<region.maxLat<<" ]"<<endl;
+        targets.clear();
+    }
+    tt.stop();
+    cout<<"CPU elapsed time: "<<tt.GetRuntime()<<" s."<<endl;
+}
 
-                flagFind=false;
-                lon=stod(vs[7]), lat=stod(vs[8]);
-                if(lon>lonP.first && lon<lonP.second && lat>latP.first && lat<latP.second){
-//            cout<<"s: "<<lon<<" "<<lat<<endl;
-                    flagFind=true;
-                }
-                lon=stod(vs[9]), lat=stod(vs[10]);
-                if(lon>lonP.first && lon<lonP.second && lat>latP.first && lat<latP.second){
-//            cout<<"t: "<<lon<<" "<<lat<<endl;
-                    flagFind=true;
-                }
-                lineNum++;
-                if(!flagFind) continue;
-
-                carID.emplace_back(vs[0]), carType.emplace_back(stoi(vs[1]));
-                travelDis.emplace_back(stoi(vs[2])), travelTime.emplace_back(stoi(vs[3])), travelSpeed.emplace_back(stoi(vs[4]));
-                startTime.emplace_back(stoll(vs[5])), endTime.emplace_back(stoll(vs[6]));
-                startPoint.emplace_back(stod(vs[7]),stod(vs[8]));
-                endPoint.emplace_back(stod(vs[9]), stod(vs[10]));
-
-                int tempInt;
-                tempInt=stoi(vs[11]);
-                linkNum.emplace_back(tempInt);
-
-                int index_i=12;
-                traTemp3.clear();
-                for(int i=0;i<tempInt;++i){
-                    traTemp3.push_back(stoll(vs[index_i]));
-                    index_i++;
-                }
-                trajectory.emplace_back(traTemp3);
+//function of keeping trajectory i of block if its start point or end point is in the region
+void TargetRegion::Add(const TrajectoryBlock& block, int i)
+{
+    if(!Contain(block.startPoint[i]) && !Contain(block.endPoint[i])) return;
+
+    trips.AddTrajectory(block,i);
+
+    if(minTime>block.startTime[i]) minTime=block.startTime[i];
+    if(maxTime<block.endTime[i]) maxTime=block.endTime[i];
+    if(minLon>block.startPoint[i].first) minLon=block.startPoint[i].first;
+    if(minLon>block.endPoint[i].first) minLon=block.endPoint[i].first;
+    if(minLat>block.startPoint[i].second) minLat=block.startPoint[i].second;
+    if(minLat>block.endPoint[i].second) minLat=block.endPoint[i].second;
+    if(maxLon<block.startPoint[i].first) maxLon=block.startPoint[i].first;
+    if(maxLon<block.endPoint[i].first) maxLon=block.endPoint[i].first;
+    if(maxLat<block.startPoint[i].second) maxLat=block.startPoint[i].second;
+    if(maxLat<block.endPoint[i].second) maxLat=block.endPoint[i].second;
+}
 
+//function of reading the named regions, one region per line: name minLon maxLon minLat maxLat
+void ReadRegions(string regionFile, string targetPath, vector<TargetRegion>& regions)
+{
+    ifstream IF(regionFile, ios::in);
+    if (!IF.is_open()) {
+        cout << "Open file failed!" << regionFile << endl;
+        exit(1);
+    }
+    string line, name, boundaryFile;
+    double minLon=0, maxLon=0, minLat=0, maxLat=0;
+    vector<string> vs;
+    while(getline(IF,line)){
+        if(line.empty() || line[0]=='#') continue;
+        istringstream iss(line);
+        vs.clear();
+        while(iss >> name) vs.push_back(name);
+        if(vs.size()==2){//name boundaryFile
+            name=vs[0], boundaryFile=vs[1];
+        }else if(vs.size()==5){//name minLon maxLon minLat maxLat
+            name=vs[0], boundaryFile.clear();
+            minLon=stod(vs[1]), maxLon=stod(vs[2]), minLat=stod(vs[3]), maxLat=stod(vs[4]);
+        }else{
+            cout<<"Wrong input syntax! "<<line<<endl;
+            exit(1);
+        }
+        bool flagFind=false;
+        for(int ri=0;ri<regions.size();++ri){
+            if(regions[ri].outputFile==targetPath+name+".trajectory"){
+                flagFind=true; break;
+            }
+        }
+        if(flagFind){
+            cout<<"Region "<<name<<" already exists, ignored."<<endl;
+            continue;
+        }
+        regions.emplace_back();
+        TargetRegion& region=regions.back();
+        region.outputFile=targetPath+name+".trajectory";
+        if(!boundaryFile.empty()){
+            if(!region.polygon.Read(boundaryFile)){
+                cout<<"No polygon in "<<boundaryFile<<" , region "<<name<<" ignored."<<endl;
+                regions.pop_back();
+                continue;
+            }
+            region.ifPolygon=true;
+            //the box is slightly larger than the bounding box since the box test is strict
+            region.lonP=make_pair(region.polygon.minLon-1e-9,region.polygon.maxLon+1e-9);
+            region.latP=make_pair(region.polygon.minLat-1e-9,region.polygon.maxLat+1e-9);
+        }else{
+            region.lonP=make_pair(minLon,maxLon);
+            region.latP=make_pair(minLat,maxLat);
+        }
+    }
+    IF.close();
+}
 
-                tempInt=stoi(vs[index_i]);
-                index_i++;
-                traTemp.clear();
-                for(int i=0;i<tempInt;++i){
-                    traTemp.push_back(stoull(vs[index_i]));
-                    index_i++;
-                }
-                trajectoryTime.emplace_back(traTemp);
-
-                tempInt=stoi(vs[index_i]);
-                index_i++;
-                traTemp2.clear();
-                for(int i=0;i<tempInt;++i){
-                    traTemp2.push_back(stoi(vs[index_i]));
-                    index_i++;
+//function of reading all polygons and multipolygons of a vector file (lon/lat coordinates), return false if there is none
+bool RegionPolygon::Read(const string& file)
+{
+    GDALAllRegister();
+    GDALDataset *poDS;  //Data source
+    poDS = (GDALDataset*) GDALOpenEx(file.c_str(), GDAL_OF_VECTOR, NULL, NULL, NULL);
+    if(poDS == NULL)
+    {
+        cout << "Open boundary file failed! " << file << endl;
+        exit(1);
+    }
+    edgeStart.clear(); edgeEnd.clear();
+    minLon=INT16_MAX, maxLon=-INT16_MAX, minLat=INT16_MAX, maxLat=-INT16_MAX;
+    int polygonNum=0;
+    for(int li=0;li<poDS->GetLayerCount();++li){
+        OGRLayer *poLayer=poDS->GetLayer(li);
+        OGRFeature *poFeature;
+        poLayer->ResetReading();
+        while((poFeature = poLayer->GetNextFeature()) != NULL){
+            OGRGeometry *poGeometry = poFeature->GetGeometryRef();
+            vector<OGRPolygon*> polygons;
+            if(poGeometry != NULL && wkbFlatten(poGeometry->getGeometryType()) == wkbPolygon){
+                polygons.push_back((OGRPolygon*)poGeometry);
+            }else if(poGeometry != NULL && wkbFlatten(poGeometry->getGeometryType()) == wkbMultiPolygon){
+                OGRMultiPolygon *poMultiPolygon = (OGRMultiPolygon*)poGeometry;
+                for(int i=0;i<poMultiPolygon->getNumGeometries();++i){
+                    polygons.push_back((OGRPolygon*)poMultiPolygon->getGeometryRef(i));
                 }
-                trajectorySpeed.emplace_back(traTemp2);
-
-                tempInt=stoi(vs[index_i]);
-                index_i++;
-                traTemp2.clear();
-                for(int i=0;i<tempInt;++i){
-                    traTemp2.push_back(stoi(vs[index_i]));
-                    index_i++;
+            }
+            for(int i=0;i<polygons.size();++i){
+                AddRing(polygons[i]->getExteriorRing());
+                for(int j=0;j<polygons[i]->getNumInteriorRings();++j){
+                    AddRing(polygons[i]->getInteriorRing(j));
                 }
-                trajectoryCity.emplace_back(traTemp2);
-
-//        cout<<tempInt<<":";
-//        for(int i=0; i<tempInt; ++i){
-//            cout<<" "<<traTemp2[i];
-//        }
-//        cout<<endl;
+                polygonNum++;
+            }
+            OGRFeature::DestroyFeature(poFeature);
+        }
+    }
+    GDALClose(poDS);
+    if(edgeStart.empty()) return false;
+    Build();
+    cout<<"Boundary "<<file<<" : polygon number: "<<polygonNum<<" ; edge number: "<<edgeStart.size()<<" ; band number: "<<bands.size()<<" ; GPS range: [ "<<minLon<<" "<<maxLon<<" ] [ "<<minLat<<" "<<maxLat<<" ]"<<endl;
+    return true;
+}
 
-                if(minTime>startTime[startTime.size()-1]) minTime=startTime[startTime.size()-1];
-                if(maxTime<endTime[endTime.size()-1]) maxTime=endTime[endTime.size()-1];
-                if(minLon>startPoint[startPoint.size()-1].first) minLon=startPoint[startPoint.size()-1].first;
-                if(minLon>endPoint[endPoint.size()-1].first) minLon=endPoint[endPoint.size()-1].first;
-                if(minLat>startPoint[startPoint.size()-1].second) minLat=startPoint[startPoint.size()-1].second;
-                if(minLat>endPoint[endPoint.size()-1].second) minLat=endPoint[endPoint.size()-1].second;
-                if(maxLon<startPoint[startPoint.size()-1].first) maxLon=startPoint[startPoint.size()-1].first;
-                if(maxLon<endPoint[endPoint.size()-1].first) maxLon=endPoint[endPoint.size()-1].first;
-                if(maxLat<startPoint[startPoint.size()-1].second) maxLat=startPoint[startPoint.size()-1].second;
-                if(maxLat<endPoint[endPoint.size()-1].second) maxLat=endPoint[endPoint.size()-1].second;
+void RegionPolygon::AddRing(OGRLinearRing* ring)
+{
+    if(ring==NULL || ring->getNumPoints()<3) return;
+    int n=ring->getNumPoints();
+    for(int i=0;i<n;++i){
+        pair<double,double> p1(ring->getX(i),ring->getY(i)), p2(ring->getX((i+1)%n),ring->getY((i+1)%n));//the closing edge is empty if the ring is already closed
+        if(p1==p2) continue;
+        edgeStart.push_back(p1), edgeEnd.push_back(p2);
+        minLon=min(minLon,p1.first), maxLon=max(maxLon,p1.first);
+        minLat=min(minLat,p1.second), maxLat=max(maxLat,p1.second);
+    }
+}
 
-            }
-            IF.close();
-            if(lineNum!=tNum){
-                cout<<"Inconsistent trajectory number! "<<lineNum<<" "<<tNum<<" "<<trajectory.size()<<endl; exit(1);
-            }
-//            cout<<"File "<<fi<<" done. "<< trajectory.size() << endl;
+//function of bucketing the edges into latitude bands, about 4 edges per band
+void RegionPolygon::Build()
+{
+    int bandNum=max<int>(1,min<int>(1<<16,edgeStart.size()/4));
+    bandHeight=(maxLat-minLat)/bandNum;
+    if(bandHeight<=0) bandHeight=1;
+    bands.assign(bandNum,vector<int>());
+    for(int i=0;i<edgeStart.size();++i){
+        double lat1=min(edgeStart[i].second,edgeEnd[i].second), lat2=max(edgeStart[i].second,edgeEnd[i].second);
+        int b1=max(0,min(bandNum-1,(int)((lat1-minLat)/bandHeight)));
+        int b2=max(0,min(bandNum-1,(int)((lat2-minLat)/bandHeight)));
+        for(int b=b1;b<=b2;++b){
+            bands[b].push_back(i);
         }
+    }
+}
 
+//function of the even-odd ray casting test, only the edges of the latitude band of p are checked
+bool RegionPolygon::Contain(const pair<double,double>& p) const
+{
+    if(p.first<minLon || p.first>maxLon || p.second<minLat || p.second>maxLat) return false;
+    int b=max(0,min((int)bands.size()-1,(int)((p.second-minLat)/bandHeight)));
+    bool inside=false;
+    for(int i:bands[b]){
+        const pair<double,double>& p1=edgeStart[i];
+        const pair<double,double>& p2=edgeEnd[i];
+        if((p1.second>p.second)!=(p2.second>p.second) && p.first<(p2.first-p1.first)*(p.second-p1.second)/(p2.second-p1.second)+p1.first){
+            inside=!inside;
+        }
+    }
+    return inside;
+}
 
-        cout << "Trajectory number: " << trajectory.size() << " ; Time range: [ "<< minTime <<" "<<maxTime<<" ] s; GPS range: [ "<< minLon<<" "<<maxLon<<" ] [ "<<minLat<<" "<<maxLat<<" ]"<<endl;
+//function of extracting the trajectory files with a pool of threadNum workers, sourceFiles keeps the order of extractFiles
+void TrajectoryExtractParallel(vector<pair<string,string>>& extractFiles, vector<string>& sourceFiles, int threadNum){
+    Timer tt;
+    tt.start();
+    vector<vector<string>> validFiles(extractFiles.size());//extracted file of each task, empty if the raw file does not exist
+    vector<stringstream> extractLogs(extractFiles.size());//the logs of the workers are printed in task order
+    vector<char> extractDone(extractFiles.size(),0);//whether the task succeeded, the workers do not exit by themselves
+    cout<<"Extracting "<<extractFiles.size()<<" files with "<<min<int>(threadNum,extractFiles.size())<<" threads."<<endl;
+    ParallelFor(extractFiles.size(), threadNum, [&](int i){
+        extractDone[i]=TrajectoryExtract(extractFiles[i].first, extractFiles[i].second, validFiles[i], extractLogs[i]);
+    });
+    bool ifFailed=false;
+    for(int i=0;i<validFiles.size();++i){
+        cout<<extractLogs[i].str();
+        if(!extractDone[i]){
+            cout<<"Extract "<<extractFiles[i].first<<" failed!"<<endl;
+            ifFailed=true;
+        }
+        sourceFiles.insert(sourceFiles.end(),validFiles[i].begin(),validFiles[i].end());
+    }
+    if(ifFailed) exit(1);
+    tt.stop();
+    cout<<"Extraction time: "<<tt.GetRuntime()<<" s."<<endl;
+}
 
-        ofstream OF(outputFile, ios::out);
-        if (!OF.is_open()) {
-            cout << "Open file failed!" << outputFile << endl;
-            exit(1);
+//function of the stable LSD radix sort of items by an unsigned integer key, 8 bits per pass, only the bits that differ from the minimum key are sorted
+template <class T, class Key>
+void RadixSort(vector<T>& items, Key key){
+    if(items.size()<2) return;
+    unsigned long long int minKey=key(items[0]), maxKey=minKey;
+    for(const T& item: items){
+        unsigned long long int k=key(item);
+        if(minKey>k) minKey=k;
+        if(maxKey<k) maxKey=k;
+    }
+    vector<T> buffer(items.size());
+    for(int shift=0;shift<64 && ((maxKey-minKey)>>shift)>0;shift+=8){
+        vector<size_t> count(257,0);
+        for(const T& item: items){
+            count[((key(item)-minKey)>>shift & 0xff)+1]++;
         }
-        OF << "carID carType travelDis travelTime travelSpeed start_time end_time start_gps_lon start_gps_lat end_gps_lon end_gps_lat linkNum links time_of_links.size time_of_links speed_of_links.size speed_of_links city_of_links.size city_of_links"<<endl;
-        OF<<trajectory.size()<<endl;
-        for(int i=0;i<trajectory.size();++i){
-            OF<<carID[i]<<" ";
-            OF<<carType[i]<<" ";
-            OF<<travelDis[i]<<" "<<travelTime[i]<<" "<<travelSpeed[i]<<" ";
-            OF<<startTime[i]<<" "<<endTime[i]<<" ";
-            OF<<startPoint[i].first<<" "<<startPoint[i].second<<" "<<endPoint[i].first<<" "<<endPoint[i].second<<" ";
-            OF<<trajectory[i].size();
-            for(int j=0;j<trajectory[i].size();++j){
-                OF<<" "<<trajectory[i][j];
-            }
-            OF<<" "<<trajectoryTime[i].size();
-            for(int j=0;j<trajectoryTime[i].size();++j){
-                OF<<" "<<trajectoryTime[i][j];
-            }
-            OF<<" "<<trajectorySpeed[i].size();
-            for(int j=0;j<trajectorySpeed[i].size();++j){
-                OF<<" "<<trajectorySpeed[i][j];
-            }
-            OF<<" "<<trajectoryCity[i].size();
-            for(int j=0;j<trajectoryCity[i].size();++j){
-                OF<<" "<<trajectoryCity[i][j];
+        for(int b=0;b<256;++b) count[b+1]+=count[b];
+        for(const T& item: items){
+            buffer[count[(key(item)-minKey)>>shift & 0xff]++]=item;
+        }
+        items.swap(buffer);
+    }
+}
+
+//function of turning the slot updates sorted by (slot, edge) into batch updates with the policy selected by changePolicy
+template <class EdgeOf>
+void DetectBatchChanges(const vector<SlotUpdate>& slotUpdates, int slotNum, EdgeOf edgeOf, vector<map<pair<int,int>,int>>& batchUpdatesFinal, ostream& log){
+    switch(changePolicy){
+        case 1: DetectChanges<ThresholdChange>(slotUpdates, slotNum, edgeOf, batchUpdatesFinal, log); break;
+        case 2: DetectChanges<RatioChange>(slotUpdates, slotNum, edgeOf, batchUpdatesFinal, log); break;
+        case 3: DetectChanges<EWMAChange>(slotUpdates, slotNum, edgeOf, batchUpdatesFinal, log); break;
+        case 4: DetectChanges<HysteresisChange>(slotUpdates, slotNum, edgeOf, batchUpdatesFinal, log); break;
+        default: DetectChanges<ThresholdRatioChange>(slotUpdates, slotNum, edgeOf, batchUpdatesFinal, log); break;
+    }
+}
+
+//function of averaging the weights of each (slot, edge) run of slotUpdates and keeping the averages accepted by Policy, edgeOf maps a new edge ID to its LCC edge and returns false if there is none
+template <class Policy, class EdgeOf>
+void DetectChanges(const vector<SlotUpdate>& slotUpdates, int slotNum, EdgeOf edgeOf, vector<map<pair<int,int>,int>>& batchUpdatesFinal, ostream& log){
+    batchUpdatesFinal.assign(slotNum,map<pair<int,int>,int>());
+    map<pair<int,int>,typename Policy::State> states;//state of each edge that has been observed
+    int ID1, ID2, baseW, newW;
+    int r=0;//current position of slotUpdates
+    for(int i=0;i<slotNum;++i){
+        while(r<slotUpdates.size() && slotUpdates[r].slot==i){//one run per edge of slot i
+            int eID=slotUpdates[r].ID;//new edge ID
+            int tempSum=0, tempNum=0;
+            for(;r<slotUpdates.size() && slotUpdates[r].slot==i && slotUpdates[r].ID==eID;++r){
+                tempSum+=slotUpdates[r].weight;
+                ++tempNum;
+            }
+            if(!edgeOf(eID,ID1,ID2,baseW)) continue;
+            //compute average edge weight
+            tempSum=ceil(tempSum/tempNum);
+            if(tempSum<1){
+                tempSum=1;
+                log<<"Smaller than 1 "<<tempSum<<endl;
+            }
+            auto it=states.find(make_pair(ID1,ID2));
+            if(it==states.end()){
+                it=states.insert({make_pair(ID1,ID2),Policy::Init(baseW)}).first;
+            }
+            if(Policy::Update(it->second,tempSum,newW)){
+                batchUpdatesFinal[i].insert({make_pair(ID1,ID2),newW});
             }
-            OF<<endl;
         }
+    }
+}
+
+//function of writing the batch updates of all time slots and their counts (outputFile+"Info"), as text to outputFile or, if batchFormat is 1, as binary to outputFile+"Bin":
+//magic, version, slot number, batch interval (unsigned int each), slotNum+1 record offsets (unsigned long long int, slot k is [offset[k], offset[k+1])), and the records <ID1, ID2, weight> (int each)
+//return false if a file cannot be opened, the error is written to log
+bool WriteBatchUpdates(const string& outputFile, int slotNum, int batchInterval, const vector<map<pair<int,int>,int>>& batchUpdatesFinal, ostream& log){
+    ofstream OF1(outputFile+"Info", ios::out);
+    if (!OF1.is_open()) {
+        log << "Open file failed!" << outputFile+"Info" << endl;
+        return false;
+    }
+    OF1<<slotNum<<endl;
+    for(int i=0;i<batchUpdatesFinal.size();++i){
+        OF1<<i<<" "<<batchUpdatesFinal[i].size()<<endl;
+    }
+    OF1.close();
+
+    if(batchFormat==1){
+        ofstream OF(outputFile+"Bin", ios::out | ios::binary);
+        if (!OF.is_open()) {
+            log << "Open file failed!" << outputFile+"Bin" << endl;
+            return false;
+        }
+        unsigned int head[4]={0,1,(unsigned int)slotNum,(unsigned int)batchInterval};
+        memcpy(head, batchMagic, sizeof(batchMagic));
+        OF.write((const char*)head, sizeof(head));
+        vector<unsigned long long int> offsets(batchUpdatesFinal.size()+1,0);
+        for(int i=0;i<batchUpdatesFinal.size();++i){
+            offsets[i+1]=offsets[i]+batchUpdatesFinal[i].size();
+        }
+        OF.write((const char*)offsets.data(), offsets.size()*sizeof(unsigned long long int));
+        vector<int> records;
+        records.reserve(3*offsets.back());
+        for(int i=0;i<batchUpdatesFinal.size();++i){
+            for(auto it=batchUpdatesFinal[i].begin();it!=batchUpdatesFinal[i].end();++it){
+                records.push_back(it->first.first);
+                records.push_back(it->first.second);
+                records.push_back(it->second);
+            }
+        }
+        OF.write((const char*)records.data(), records.size()*sizeof(int));
         OF.close();
-        tt.stop();
-        cout<<"CPU elapsed time: "<<tt.GetRuntime()<<" s."<<endl;
+        return true;
     }
 
+    ofstream OF(outputFile, ios::out);
+    if (!OF.is_open()) {
+        log << "Open file failed!" << outputFile << endl;
+        return false;
+    }
+    OF<<slotNum<<" "<<batchInterval<<endl;
+    for(int i=0;i<batchUpdatesFinal.size();++i){
+        OF<<batchUpdatesFinal[i].size();
+        for(auto it=batchUpdatesFinal[i].begin();it!=batchUpdatesFinal[i].end();++it){
+            OF<<" "<<it->first.first<<" "<<it->first.second<<" "<<it->second;
+        }
+        OF<<endl;
+    }
+    OF.close();
+    return true;
+}
 
+//function of keeping the observations <edge weight, time> whose rank percentile is in (trimLower, trimUpper], by nth_element in linear time, the kept observations are not sorted
+void TrimObservations(vector<pair<int,unsigned long long int>>& weights){
+    int n=weights.size();
+    if(n<trimMinNum) return;
+    int hi=n;//observation j (0-based rank) is kept if lo <= j < hi, i.e., (j+1)/n in (trimLower, trimUpper]
+    while(hi>0 && (double)hi/n > trimUpper) --hi;
+    int lo=0;
+    while(lo<hi && (double)(lo+1)/n <= trimLower) ++lo;
+    if(hi<n){
+        nth_element(weights.begin(),weights.begin()+hi,weights.end());
+    }
+    if(lo>0){
+        nth_element(weights.begin(),weights.begin()+lo,weights.begin()+hi);
+    }
+    weights.erase(weights.begin()+hi,weights.end());
+    weights.erase(weights.begin(),weights.begin()+lo);
 }
 
-//function of extracting useful information from original trajectory file
-void TrajectoryExtract(string sourceFile, string outputFile, vector<string>& sourceFiles) {
+//function of extracting useful information from original trajectory file, each valid row is written out once it is parsed
+//return false on a malformed file or a write failure, the error is written to log and the caller exits
+bool TrajectoryExtract(string sourceFile, string outputFile, vector<string>& sourceFiles, ostream& log) {
     ifstream IFOut(outputFile);
     if(IFOut.is_open()){//if exist
 //        cout<<"File "<<outputFile<<" already exist."<<endl;
@@ -2106,146 +2497,697 @@ void TrajectoryExtract(string sourceFile, string outputFile, vector<string>& sou
     }
     else{//if not open
         IFOut.close();
-        ifstream IF(sourceFile, ios::in);
-        if (!IF.is_open()) {//if not open
+        MappedFile IF;
+        if (!IF.open(sourceFile)) {//if not open
 //            cout << "Open file failed! " << sourceFile << endl;
 //        exit(1);
         }
         else{
-            cout << "Processing " << sourceFile << endl;
+            log << "Processing " << sourceFile << endl;
             Timer tt;
             tt.start();
-            vector<string> vs;
-            string line;
-            unsigned long long int EdgeID;
-            unsigned long long int TimeID;//Time to 1970, unit: s
-            vector<string> carID;
-            vector<int> carType;//1: private car; 2: taxi; 0: others
-            vector<vector<string>> trajectory;
-            vector<vector<string>> trajectoryTime;
-            vector<vector<string>> trajectorySpeed;
-            vector<vector<string>> trajectoryCity;
-            vector<int> linkNum;
-            vector<int> travelDis, travelTime, travelSpeed;
-            vector<pair<double,double>> startPoint;//gps
-            vector<pair<double,double>> endPoint;//gps
-            vector<unsigned long long int> startTime, endTime;
+            vector<string_view> vs;//fields of one row, pointing into the mapped file
+            string_view line;
+            size_t pos=0;
             int lineNum = 0;
-            vector<string> traTemp;
+            int linkNum;
+            vector<string_view> traTemp;
+            TrajectoryBlock row;//the current trajectory
+            unsigned long long int startTime, endTime;
 
             unsigned long long int minTime=INT64_MAX, maxTime=0;
             double minLon=INT16_MAX, minLat=INT16_MAX;
             double maxLon=-INT16_MAX, maxLat=-INT16_MAX;
 
-            cout<<"Reading trajectories..."<<endl;
+            //write to a temporary file so that an interrupted run does not leave a truncated output behind
+            TrajectoryWriter OF;
+            if (!OF.open(outputFile+".tmp", trajectoryFormat, true)) {
+                log << "Open file failed!" << outputFile+".tmp" << endl;
+                return false;
+            }
+            TrajectoryGrid grid;//spatial grid of the extracted file, so that GetTargetTrajectory only reads the candidate trajectories of a region
+            grid.cellSize=gridCellSize;
+
+            log<<"Reading trajectories..."<<endl;
             long long int invalidNum=0;
-            while (getline(IF, line)) {
-                if (line == "") continue;
-                vs.clear();
-                boost::split(vs,line,boost::is_any_of(","));
-//        vs=split(line,",");//link ID of trajectory
+            while (NextLine(IF, pos, line)) {
+                if (line.empty()) continue;
+                SplitView(line, ',', vs);
                 if (vs.size() < 28) {
-                    cout << "Wrong syntax! " <<vs.size() <<" : "<< line << endl;
-                    exit(1);
+                    log << "Wrong syntax! " <<vs.size() <<" : "<< line << endl;
+                    return false;
                 }
 
-                if(stoll(vs[26])<1448899200 || stoll(vs[27])>1454256000){//if the start time stamp is before December 1st 2015 or the end time stamp is after February 1st 2016
-//                cout<<lineNum<<": "<<minTime<<" "<< startTime[startTime.size()-1]<<endl;
+                long long int time1, time2;
+                if(!ViewToLL(vs[26],time1) || !ViewToLL(vs[27],time2)){
+                    log << "Wrong time syntax! " << vs[26] << " " << vs[27] << endl;
+                    return false;
+                }
+                startTime=time1, endTime=time2;
+                if(startTime<1448899200 || endTime>1454256000){//if the start time stamp is before December 1st 2015 or the end time stamp is after February 1st 2016
                     invalidNum++;
                     continue;
                 }
-
-                carID.emplace_back(vs[2]), carType.emplace_back(stoi(vs[3]));
-                linkNum.emplace_back(stoi(vs[11]));
-
-                traTemp.clear();
-                boost::split(traTemp,vs[4],boost::is_any_of("|"));
-//        traTemp=split(vs[4],"|");//link ID of trajectory
-                trajectory.emplace_back(traTemp);
-                if(linkNum[linkNum.size()-1] != traTemp.size()){
-                    cout<<"Incorrect link number: "<<linkNum[linkNum.size()-1]<<" "<<traTemp.size()<<endl; exit(1);
+                row.clear();
+                bool ifValid=true;//false if an integer field is malformed or a link has no ID or time
+                auto field=[&](string_view f){ long long int value; if(!FieldToLL(f,value)) ifValid=false; return value; };
+                row.carDict.emplace_back(vs[2]), row.carID.emplace_back(0);//one trajectory, no dictionary lookup
+                row.carType.emplace_back(field(vs[3]));
+                row.travelDis.emplace_back(field(vs[14])), row.travelTime.emplace_back(field(vs[15])), row.travelSpeed.emplace_back(field(vs[16]));
+                row.startTime.emplace_back(startTime), row.endTime.emplace_back(endTime);
+                row.startPoint.emplace_back(), row.endPoint.emplace_back();
+                if(!ViewToDouble(vs[22],row.startPoint[0].first) || !ViewToDouble(vs[23],row.startPoint[0].second) || !ViewToDouble(vs[24],row.endPoint[0].first) || !ViewToDouble(vs[25],row.endPoint[0].second)){
+                    log << "Wrong GPS syntax! " << vs[22] << " " << vs[23] << " " << vs[24] << " " << vs[25] << endl;
+                    return false;
                 }
 
-                traTemp.clear();
-                boost::split(traTemp,vs[7],boost::is_any_of("|"));
-//        traTemp=split(vs[7],"|");//traveled city
-                trajectoryCity.emplace_back(traTemp);
-
-                traTemp.clear();
-                boost::split(traTemp,vs[8],boost::is_any_of("|"));
-//        traTemp=split(vs[8],"|");//time of each link
-                trajectoryTime.emplace_back(traTemp);
-
-                traTemp.clear();
-                boost::split(traTemp,vs[9],boost::is_any_of("|"));
-//        traTemp=split(vs[8],"|");//time of each link
-                trajectorySpeed.emplace_back(traTemp);
-
-                travelDis.emplace_back(stoi(vs[14])), travelTime.emplace_back(stoi(vs[15])), travelSpeed.emplace_back(stoi(vs[16]));
-
-                startPoint.emplace_back(stod(vs[22]),stod(vs[23]));
-                endPoint.emplace_back(stod(vs[24]), stod(vs[25]));
-                startTime.emplace_back(stoll(vs[26])), endTime.emplace_back(stoll(vs[27]));
-                if(minTime>startTime[startTime.size()-1]) minTime=startTime[startTime.size()-1];
-                if(maxTime<endTime[endTime.size()-1]) maxTime=endTime[endTime.size()-1];
-                if(minLon>startPoint[startPoint.size()-1].first) minLon=startPoint[startPoint.size()-1].first;
-                if(minLon>endPoint[endPoint.size()-1].first) minLon=endPoint[endPoint.size()-1].first;
-                if(minLat>startPoint[startPoint.size()-1].second) minLat=startPoint[startPoint.size()-1].second;
-                if(minLat>endPoint[endPoint.size()-1].second) minLat=endPoint[endPoint.size()-1].second;
-                if(maxLon<startPoint[startPoint.size()-1].first) maxLon=startPoint[startPoint.size()-1].first;
-                if(maxLon<endPoint[endPoint.size()-1].first) maxLon=endPoint[endPoint.size()-1].first;
-                if(maxLat<startPoint[startPoint.size()-1].second) maxLat=startPoint[startPoint.size()-1].second;
-                if(maxLat<endPoint[endPoint.size()-1].second) maxLat=endPoint[endPoint.size()-1].second;
+                linkNum=field(vs[11]);
+                SplitView(vs[4], '|', traTemp);//link ID of trajectory
+                if(linkNum != traTemp.size()){
+                    log<<"Incorrect link number: "<<linkNum<<" "<<traTemp.size()<<endl;
+                    return false;
+                }
+                for(int j=0;j<traTemp.size();++j){
+                    if(traTemp[j].empty()) ifValid=false;//a link must have an ID
+                    row.links.emplace_back(field(traTemp[j]));
+                }
+                SplitView(vs[8], '|', traTemp);//time of each link
+                for(int j=0;j<traTemp.size();++j){
+                    if(traTemp[j].empty()) ifValid=false;//a link must have a time, 0 would be taken as a timestamp
+                    row.linkTime.emplace_back(field(traTemp[j]));
+                }
+                SplitView(vs[9], '|', traTemp);//speed of each link
+                for(int j=0;j<traTemp.size();++j){
+                    row.linkSpeed.emplace_back(field(traTemp[j]));
+                }
+                SplitView(vs[7], '|', traTemp);//traveled city
+                for(int j=0;j<traTemp.size();++j){
+                    row.linkCity.emplace_back(field(traTemp[j]));
+                }
+                if(!ifValid){
+                    invalidNum++;
+                    continue;
+                }
+                row.linkOffset.emplace_back(row.links.size()), row.timeOffset.emplace_back(row.linkTime.size());
+                row.speedOffset.emplace_back(row.linkSpeed.size()), row.cityOffset.emplace_back(row.linkCity.size());
+                grid.Add(row.startPoint[0], row.endPoint[0], OF.tripNum);
+                OF.Write(row,0);
+
+                pair<double,double>& startPoint=row.startPoint[0];
+                pair<double,double>& endPoint=row.endPoint[0];
+                if(minTime>startTime) minTime=startTime;
+                if(maxTime<endTime) maxTime=endTime;
+                if(minLon>startPoint.first) minLon=startPoint.first;
+                if(minLon>endPoint.first) minLon=endPoint.first;
+                if(minLat>startPoint.second) minLat=startPoint.second;
+                if(minLat>endPoint.second) minLat=endPoint.second;
+                if(maxLon<startPoint.first) maxLon=startPoint.first;
+                if(maxLon<endPoint.first) maxLon=endPoint.first;
+                if(maxLat<startPoint.second) maxLat=startPoint.second;
+                if(maxLat<endPoint.second) maxLat=endPoint.second;
                 lineNum++;
             }
             IF.close();
-            if(trajectory.size()!=lineNum){
-                cout<<"Inconsistent trajectory number! "<<trajectory.size()<<" "<<lineNum<<endl; exit(1);
+            grid.tripNum=OF.tripNum;
+            if(!OF.close() || !grid.Write(outputFile+".tmp.grid")){
+                log << "Write file failed!" << outputFile+".tmp" << endl;
+                return false;
+            }
+            if(rename((outputFile+".tmp.index").c_str(), (outputFile+".index").c_str())!=0 || rename((outputFile+".tmp.grid").c_str(), (outputFile+".grid").c_str())!=0 || rename((outputFile+".tmp").c_str(), outputFile.c_str())!=0){
+                log << "Rename file failed!" << outputFile << endl;
+                return false;
             }
 
-            cout << "Trajectory number: " << lineNum << " ; Time range: [ "<< minTime <<" "<<maxTime<<" ] s; GPS range: [ "<< minLon<<" "<<maxLon<<" ] [ "<<minLat<<" "<<maxLat<<" ]"<<endl;
-            cout << "Invalid trajectory number: "<<invalidNum<<endl;
+            log << outputFile << " trajectory number: " << lineNum << " ; Time range: [ "<< minTime <<" "<<maxTime<<" ] s; GPS range: [ "<< minLon<<" "<<maxLon<<" ] [ "<<minLat<<" "<<maxLat<<" ]"<<endl;
+            log << outputFile << " invalid trajectory number: "<<invalidNum<<endl;
+            tt.stop();
+            sourceFiles.push_back(outputFile);
+            log<<"CPU elapsed time: "<<tt.GetRuntime()<<" s."<<endl;
+        }
+    }
+    return true;
+}
 
-            ofstream OF(outputFile, ios::out);
-            if (!OF.is_open()) {
-                cout << "Open file failed!" << outputFile << endl;
-                exit(1);
+
+//function of finding the position of key in the sorted keys, -1 if not found
+int DenseIndex(const vector<long long int>& keys, long long int key)
+{
+    auto it=lower_bound(keys.begin(), keys.end(), key);
+    if(it==keys.end() || *it!=key) return -1;
+    return it-keys.begin();
+}
+
+//function of splitting a string view by one separator without copying, empty fields are kept (same as boost::split)
+void SplitView(string_view s, char seperator, vector<string_view>& result)
+{
+    result.clear();
+    size_t i=0, j;
+    while((j=s.find(seperator,i))!=string_view::npos){
+        result.emplace_back(s.substr(i,j-i));
+        i=j+1;
+    }
+    result.emplace_back(s.substr(i));
+}
+
+//function of getting the next line of a mapped file, return false at the end of file
+bool NextLine(const MappedFile& mf, size_t& pos, string_view& line)
+{
+    if(pos>=mf.size) return false;
+    const char* begin=mf.data+pos;
+    const char* end=(const char*)memchr(begin,'\n',mf.size-pos);
+    if(end==nullptr){
+        line=string_view(begin,mf.size-pos);
+        pos=mf.size;
+    }else{
+        line=string_view(begin,end-begin);
+        pos+=line.size()+1;
+    }
+    return true;
+}
+
+long long int ViewToLL(string_view s)
+{
+    long long int value;
+    if(!ViewToLL(s,value)){
+        cout<<"Wrong integer syntax! "<<s<<endl; exit(1);
+    }
+    return value;
+}
+
+//function of parsing an integer field, return false if it is not a number
+bool ViewToLL(string_view s, long long int& value)
+{
+    value=0;
+    const char* first=s.data();
+    if(!s.empty() && s[0]=='+') ++first;
+    auto res=from_chars(first, s.data()+s.size(), value);
+    return res.ec==errc();
+}
+
+//function of parsing an integer field of the source file, an empty field is 0 (only for fields where 0 is meaningful), return false if it is malformed
+bool FieldToLL(string_view s, long long int& value)
+{
+    value=0;
+    if(s.empty()) return true;
+    const char* first=s.data();
+    if(s[0]=='+') ++first;
+    auto res=from_chars(first, s.data()+s.size(), value);
+    return res.ec==errc() && res.ptr==s.data()+s.size();
+}
+
+double ViewToDouble(string_view s)
+{
+    double value;
+    if(!ViewToDouble(s,value)){
+        cout<<"Wrong double syntax! "<<s<<endl; exit(1);
+    }
+    return value;
+}
+
+//function of parsing a floating-point field, return false if it is not a number
+bool ViewToDouble(string_view s, double& value)
+{
+    value=0;
+    char buf[64];//GPS fields are short, copy to get a terminated string for strtod
+    if(s.empty() || s.size()>=sizeof(buf)) return false;
+    memcpy(buf,s.data(),s.size());
+    buf[s.size()]='\0';
+    char* end;
+    value=strtod(buf,&end);
+    return end!=buf;
+}
+void TrajectoryBlock::clear()
+{
+    carDict.clear(); carID.clear(); carType.clear();
+    travelDis.clear(); travelTime.clear(); travelSpeed.clear();
+    startTime.clear(); endTime.clear(); startPoint.clear(); endPoint.clear();
+    linkOffset.assign(1,0); timeOffset.assign(1,0); speedOffset.assign(1,0); cityOffset.assign(1,0);
+    links.clear(); linkTime.clear(); linkSpeed.clear(); linkCity.clear();
+    carIndex.clear();
+}
+
+int TrajectoryBlock::AddCar(string_view id)
+{
+    auto res=carIndex.try_emplace(string(id),carDict.size());//the key is built once
+    if(res.second){//if not found
+        carDict.emplace_back(id);
+    }
+    return res.first->second;
+}
+
+//function of appending the i-th trajectory of another block
+void TrajectoryBlock::AddTrajectory(const TrajectoryBlock& block, int i)
+{
+    carID.emplace_back(AddCar(block.carDict[block.carID[i]]));
+    carType.emplace_back(block.carType[i]);
+    travelDis.emplace_back(block.travelDis[i]), travelTime.emplace_back(block.travelTime[i]), travelSpeed.emplace_back(block.travelSpeed[i]);
+    startTime.emplace_back(block.startTime[i]), endTime.emplace_back(block.endTime[i]);
+    startPoint.emplace_back(block.startPoint[i]), endPoint.emplace_back(block.endPoint[i]);
+    links.insert(links.end(), block.links.begin()+block.linkOffset[i], block.links.begin()+block.linkOffset[i+1]);
+    linkOffset.emplace_back(links.size());
+    linkTime.insert(linkTime.end(), block.linkTime.begin()+block.timeOffset[i], block.linkTime.begin()+block.timeOffset[i+1]);
+    timeOffset.emplace_back(linkTime.size());
+    linkSpeed.insert(linkSpeed.end(), block.linkSpeed.begin()+block.speedOffset[i], block.linkSpeed.begin()+block.speedOffset[i+1]);
+    speedOffset.emplace_back(linkSpeed.size());
+    linkCity.insert(linkCity.end(), block.linkCity.begin()+block.cityOffset[i], block.linkCity.begin()+block.cityOffset[i+1]);
+    cityOffset.emplace_back(linkCity.size());
+}
+
+bool TrajectoryWriter::open(const string& file, int format, bool ifIndex)
+{
+    filename=file;
+    binary=format>0;
+    version=format;
+    tripNum=0, blockNum=0;
+    block.clear();
+    this->ifIndex=ifIndex;
+    index.clear();
+    OF.open(filename, ios::out | ios::binary);
+    if(!OF.is_open()) return false;
+    if(binary){
+        OF.write(trajectoryMagic, sizeof(trajectoryMagic));
+        OF.write((const char*)&version, sizeof(version));
+        countPos=OF.tellp();
+        OF.write((const char*)&tripNum, sizeof(tripNum));
+        OF.write((const char*)&blockNum, sizeof(blockNum));
+    }else{
+        OF << "carID carType travelDis travelTime travelSpeed start_time end_time start_gps_lon start_gps_lat end_gps_lon end_gps_lat linkNum links time_of_links.size time_of_links speed_of_links.size speed_of_links city_of_links.size city_of_links"<<endl;
+        countPos=OF.tellp();
+        OF<<setw(10)<<setfill('0')<<0<<setfill(' ')<<endl;//trajectory number, fixed width so that it can be filled in at the end
+    }
+    return true;
+}
+
+void TrajectoryWriter::Write(const TrajectoryBlock& source, int i)
+{
+    if(ifIndex){
+        if(tripNum%trajectoryBlockSize==0){//first trajectory of a block, the previous binary block has been flushed
+            index.offset.emplace_back(OF.tellp());
+            index.minStart.emplace_back(source.startTime[i]);
+            index.maxEnd.emplace_back(source.endTime[i]);
+        }else{
+            index.minStart.back()=min(index.minStart.back(),source.startTime[i]);
+            index.maxEnd.back()=max(index.maxEnd.back(),source.endTime[i]);
+        }
+    }
+    tripNum++;
+    if(binary){
+        block.AddTrajectory(source,i);
+        if(block.size()>=trajectoryBlockSize){
+            FlushBlock();
+        }
+        return;
+    }
+    OF<<source.carDict[source.carID[i]]<<" ";
+    OF<<source.carType[i]<<" ";
+    OF<<source.travelDis[i]<<" "<<source.travelTime[i]<<" "<<source.travelSpeed[i]<<" ";
+    OF<<source.startTime[i]<<" "<<source.endTime[i]<<" ";
+    OF<<source.startPoint[i].first<<" "<<source.startPoint[i].second<<" "<<source.endPoint[i].first<<" "<<source.endPoint[i].second<<" ";
+    OF<<source.linkOffset[i+1]-source.linkOffset[i];
+    for(auto j=source.linkOffset[i];j<source.linkOffset[i+1];++j){
+        OF<<" "<<source.links[j];
+    }
+    OF<<" "<<source.timeOffset[i+1]-source.timeOffset[i];
+    for(auto j=source.timeOffset[i];j<source.timeOffset[i+1];++j){
+        OF<<" "<<source.linkTime[j];
+    }
+    OF<<" "<<source.speedOffset[i+1]-source.speedOffset[i];
+    for(auto j=source.speedOffset[i];j<source.speedOffset[i+1];++j){
+        OF<<" "<<source.linkSpeed[j];
+    }
+    OF<<" "<<source.cityOffset[i+1]-source.cityOffset[i];
+    for(auto j=source.cityOffset[i];j<source.cityOffset[i+1];++j){
+        OF<<" "<<source.linkCity[j];
+    }
+    OF<<"\n";
+}
+
+//function of writing the buffered trajectories as one block: block header, car dictionary, trajectory columns, link columns
+void TrajectoryWriter::FlushBlock()
+{
+    if(block.size()==0) return;
+    vector<unsigned long long int> dictOffset(1,0);
+    string dictChars;
+    for(int i=0;i<block.carDict.size();++i){
+        dictChars+=block.carDict[i];
+        dictOffset.emplace_back(dictChars.size());
+    }
+    string linkBytes, timeBytes;
+    if(version==2){
+        for(int i=0;i<block.size();++i){
+            EncodeDeltaVarint(linkBytes, &block.links[block.linkOffset[i]], block.linkNum(i), 0);
+            EncodeDeltaVarint(timeBytes, &block.linkTime[block.timeOffset[i]], block.timeOffset[i+1]-block.timeOffset[i], block.startTime[i]);
+        }
+    }
+    unsigned long long int blockHead[9]={block.size(), block.carDict.size(), dictChars.size(), block.links.size(), block.linkTime.size(), block.linkSpeed.size(), block.linkCity.size(), linkBytes.size(), timeBytes.size()};
+    OF.write((const char*)blockHead, (version==2?9:7)*sizeof(unsigned long long int));
+    WriteColumn(OF, dictOffset);
+    OF.write(dictChars.data(), dictChars.size());
+    WriteColumn(OF, block.carID); WriteColumn(OF, block.carType);
+    WriteColumn(OF, block.travelDis); WriteColumn(OF, block.travelTime); WriteColumn(OF, block.travelSpeed);
+    WriteColumn(OF, block.startTime); WriteColumn(OF, block.endTime);
+    WriteColumn(OF, block.startPoint); WriteColumn(OF, block.endPoint);
+    WriteColumn(OF, block.linkOffset); WriteColumn(OF, block.timeOffset); WriteColumn(OF, block.speedOffset); WriteColumn(OF, block.cityOffset);
+    if(version==2){
+        OF.write(linkBytes.data(), linkBytes.size());
+        OF.write(timeBytes.data(), timeBytes.size());
+    }else{
+        WriteColumn(OF, block.links); WriteColumn(OF, block.linkTime);
+    }
+    WriteColumn(OF, block.linkSpeed); WriteColumn(OF, block.linkCity);
+    blockNum++;
+    block.clear();
+}
+
+bool TrajectoryWriter::close()
+{
+    if(binary){
+        FlushBlock();
+        OF.seekp(countPos);
+        OF.write((const char*)&tripNum, sizeof(tripNum));
+        OF.write((const char*)&blockNum, sizeof(blockNum));
+    }else{
+        OF.seekp(countPos);
+        OF<<setw(10)<<setfill('0')<<tripNum<<setfill(' ');
+    }
+    OF.seekp(0, ios::end);
+    index.fileSize=OF.tellp();
+    index.tripNum=tripNum;
+    OF.close();
+    if(ifIndex){
+        return index.Write(filename+".index");
+    }
+    return true;
+}
+
+void TrajectoryGrid::Add(const pair<double,double>& startPoint, const pair<double,double>& endPoint, unsigned int ordinal)
+{
+    pair<int,int> c1=Cell(startPoint), c2=Cell(endPoint);
+    cells[c1].emplace_back(ordinal);
+    if(c2!=c1){
+        cells[c2].emplace_back(ordinal);
+    }
+}
+
+//function of collecting the sorted ordinal numbers of the trajectories in the cells overlapping the lon/lat box
+void TrajectoryGrid::Candidates(pair<double,double> lonP, pair<double,double> latP, vector<unsigned int>& ordinals) const
+{
+    ordinals.clear();
+    pair<int,int> c1=Cell(make_pair(lonP.first,latP.first)), c2=Cell(make_pair(lonP.second,latP.second));
+    for(auto it=cells.begin();it!=cells.end();++it){
+        if(it->first.first<c1.first || it->first.first>c2.first || it->first.second<c1.second || it->first.second>c2.second) continue;
+        ordinals.insert(ordinals.end(), it->second.begin(), it->second.end());
+    }
+    sort(ordinals.begin(), ordinals.end());
+    ordinals.erase(unique(ordinals.begin(), ordinals.end()), ordinals.end());
+}
+
+//function of reading the spatial grid, return false if it does not exist
+bool TrajectoryGrid::Read(const string& file)
+{
+    cells.clear();
+    ifstream IF(file, ios::in);
+    if(!IF.is_open()) return false;
+    int cellNum, x, y, num;
+    if(!(IF >> cellSize >> tripNum >> cellNum)) return false;
+    for(int i=0;i<cellNum;++i){
+        if(!(IF >> x >> y >> num)){
+            cout<<"Wrong grid file! "<<file<<endl; exit(1);
+        }
+        vector<unsigned int>& cell=cells[make_pair(x,y)];
+        cell.assign(num,0);
+        for(int j=0;j<num;++j){
+            if(!(IF >> cell[j])){
+                cout<<"Wrong grid file! "<<file<<endl; exit(1);
             }
-            OF << "carID carType travelDis travelTime travelSpeed start_time end_time start_gps_lon start_gps_lat end_gps_lon end_gps_lat linkNum links time_of_links.size time_of_links speed_of_links.size speed_of_links city_of_links.size city_of_links"<<endl;
-            OF<<lineNum<<endl;
-            for(int i=0;i<lineNum;++i){
-//            if(startTime[i]<1400000000) continue;
-                OF<<carID[i]<<" ";
-                OF<<carType[i]<<" ";
-                OF<<travelDis[i]<<" "<<travelTime[i]<<" "<<travelSpeed[i]<<" ";
-                OF<<startTime[i]<<" "<<endTime[i]<<" ";
-                OF<<startPoint[i].first<<" "<<startPoint[i].second<<" "<<endPoint[i].first<<" "<<endPoint[i].second<<" ";
-                OF<<trajectory[i].size();
-                for(int j=0;j<trajectory[i].size();++j){
-                    OF<<" "<<trajectory[i][j];
-                }
-                OF<<" "<<trajectoryTime[i].size();
-                for(int j=0;j<trajectoryTime[i].size();++j){
-                    OF<<" "<<trajectoryTime[i][j];
-                }
-                OF<<" "<<trajectorySpeed[i].size();
-                for(int j=0;j<trajectorySpeed[i].size();++j){
-                    OF<<" "<<trajectorySpeed[i][j];
-                }
-                OF<<" "<<trajectoryCity[i].size();
-                for(int j=0;j<trajectoryCity[i].size();++j){
-                    OF<<" "<<trajectoryCity[i][j];
+        }
+    }
+    IF.close();
+    return true;
+}
+
+bool TrajectoryGrid::Write(const string& file)
+{
+    ofstream OF(file, ios::out);
+    if(!OF.is_open()) return false;
+    OF<<cellSize<<" "<<tripNum<<" "<<cells.size()<<endl;
+    for(auto it=cells.begin();it!=cells.end();++it){
+        OF<<it->first.first<<" "<<it->first.second<<" "<<it->second.size();
+        for(int j=0;j<it->second.size();++j){
+            OF<<" "<<it->second[j];
+        }
+        OF<<"\n";
+    }
+    OF.close();
+    return true;
+}
+
+//function of reading the block index, return false if it does not exist
+bool TrajectoryIndex::Read(const string& file)
+{
+    clear();
+    ifstream IF(file, ios::in);
+    if(!IF.is_open()) return false;
+    unsigned long long int blockNum;
+    if(!(IF >> blockNum >> tripNum >> fileSize)) return false;
+    offset.assign(blockNum,0); minStart.assign(blockNum,0); maxEnd.assign(blockNum,0);
+    for(int i=0;i<blockNum;++i){
+        if(!(IF >> offset[i] >> minStart[i] >> maxEnd[i])){
+            cout<<"Wrong index file! "<<file<<endl; exit(1);
+        }
+    }
+    IF.close();
+    return true;
+}
+
+bool TrajectoryIndex::Write(const string& file)
+{
+    ofstream OF(file, ios::out);
+    if(!OF.is_open()) return false;
+    OF<<offset.size()<<" "<<tripNum<<" "<<fileSize<<endl;
+    for(int i=0;i<offset.size();++i){
+        OF<<offset[i]<<" "<<minStart[i]<<" "<<maxEnd[i]<<"\n";
+    }
+    OF.close();
+    return true;
+}
+
+bool TrajectoryReader::open(const string& file)
+{
+    pos=0;
+    blockI=0;
+    if(!IF.open(file)) return false;
+    binary = IF.size>=sizeof(trajectoryMagic) && memcmp(IF.data, trajectoryMagic, sizeof(trajectoryMagic))==0;
+    if(binary){
+        unsigned long long int blockNum;
+        if(IF.size<24){
+            cout<<"Wrong binary trajectory file! "<<file<<endl; exit(1);
+        }
+        memcpy(&version, IF.data+4, sizeof(version));
+        if(version!=1 && version!=2){
+            cout<<"Unsupported binary trajectory version "<<version<<" "<<file<<endl; exit(1);
+        }
+        memcpy(&tripNum, IF.data+8, sizeof(tripNum));
+        memcpy(&blockNum, IF.data+16, sizeof(blockNum));
+        pos=24;
+    }else{
+        string_view line;
+        NextLine(IF, pos, line);//column names
+        NextLine(IF, pos, line);
+        SplitView(line, ' ', vs);
+        if (vs.size() != 1) {
+            cout << "Wrong syntax! " <<vs.size() <<" : "<< line << endl;
+            exit(1);
+        }
+        tripNum=ViewToLL(vs[0]);
+    }
+    ifIndex=index.Read(file+".index");
+    if(ifIndex && (index.tripNum!=tripNum || index.fileSize!=IF.size)){
+        cout<<"Stale index file "<<file+".index"<<" is ignored."<<endl;
+        ifIndex=false;
+    }
+    return true;
+}
+
+void TrajectoryReader::ReadBlockAt(TrajectoryBlock& block, int bi)
+{
+    if(!ifIndex || bi<0 || bi>=index.offset.size()){
+        cout<<"Wrong block "<<bi<<" of the trajectory file!"<<endl; exit(1);
+    }
+    pos=index.offset[bi];
+    ReadBlock(block);
+}
+
+bool TrajectoryReader::ReadBlock(TrajectoryBlock& block, unsigned long long int startT, unsigned long long int endT)
+{
+    if(!ifIndex) return ReadBlock(block);
+    while(blockI<index.offset.size()){
+        int bi=blockI++;
+        if(index.minStart[bi]>endT || index.maxEnd[bi]<startT) continue;
+        pos=index.offset[bi];
+        return ReadBlock(block);
+    }
+    block.clear();
+    return false;
+}
+
+bool TrajectoryReader::ReadBlock(TrajectoryBlock& block)
+{
+    block.clear();
+    if(binary){
+        if(pos>=IF.size) return false;
+        vector<unsigned long long int> blockHead, dictOffset;
+        ReadColumn(IF, pos, blockHead, version==2?9:7);
+        size_t num=blockHead[0];
+        ReadColumn(IF, pos, dictOffset, blockHead[1]+1);
+        if(pos+blockHead[2]>IF.size){
+            cout<<"Wrong binary trajectory file! "<<pos<<" "<<IF.size<<endl; exit(1);
+        }
+        for(int i=0;i<blockHead[1];++i){
+            block.carDict.emplace_back(IF.data+pos+dictOffset[i], dictOffset[i+1]-dictOffset[i]);
+        }
+        pos+=blockHead[2];
+        ReadColumn(IF, pos, block.carID, num); ReadColumn(IF, pos, block.carType, num);
+        ReadColumn(IF, pos, block.travelDis, num); ReadColumn(IF, pos, block.travelTime, num); ReadColumn(IF, pos, block.travelSpeed, num);
+        ReadColumn(IF, pos, block.startTime, num); ReadColumn(IF, pos, block.endTime, num);
+        ReadColumn(IF, pos, block.startPoint, num); ReadColumn(IF, pos, block.endPoint, num);
+        ReadColumn(IF, pos, block.linkOffset, num+1); ReadColumn(IF, pos, block.timeOffset, num+1);
+        ReadColumn(IF, pos, block.speedOffset, num+1); ReadColumn(IF, pos, block.cityOffset, num+1);
+        if(version==2){
+            if(pos+blockHead[7]+blockHead[8]>IF.size){
+                cout<<"Wrong binary trajectory file! "<<pos<<" "<<IF.size<<endl; exit(1);
+            }
+            block.links.resize(blockHead[3]);
+            block.linkTime.resize(blockHead[4]);
+            const unsigned char* p=(const unsigned char*)IF.data+pos;
+            const unsigned char* end=p+blockHead[7];
+            for(int i=0;i<num;++i){
+                DecodeDeltaVarint(p, end, &block.links[block.linkOffset[i]], block.linkNum(i), 0);
+            }
+            end+=blockHead[8];
+            for(int i=0;i<num;++i){
+                DecodeDeltaVarint(p, end, &block.linkTime[block.timeOffset[i]], block.timeOffset[i+1]-block.timeOffset[i], block.startTime[i]);
+            }
+            if(p!=end){
+                cout<<"Wrong binary trajectory file! "<<pos<<" "<<IF.size<<endl; exit(1);
+            }
+            pos+=blockHead[7]+blockHead[8];
+        }else{
+            ReadColumn(IF, pos, block.links, blockHead[3]); ReadColumn(IF, pos, block.linkTime, blockHead[4]);
+        }
+        ReadColumn(IF, pos, block.linkSpeed, blockHead[5]); ReadColumn(IF, pos, block.linkCity, blockHead[6]);
+        return true;
+    }
+    string_view line;
+    while(block.size()<trajectoryBlockSize && NextLine(IF, pos, line)){
+        if (line.empty()) continue;
+        SplitView(line, ' ', vs);
+        if (vs.size() < 17) {
+            cout << "Wrong syntax! " <<vs.size() <<" : "<< line << endl;
+            exit(1);
+        }
+        block.carID.emplace_back(block.AddCar(vs[0])), block.carType.emplace_back(ViewToLL(vs[1]));
+        block.travelDis.emplace_back(ViewToLL(vs[2])), block.travelTime.emplace_back(ViewToLL(vs[3])), block.travelSpeed.emplace_back(ViewToLL(vs[4]));
+        block.startTime.emplace_back(ViewToLL(vs[5])), block.endTime.emplace_back(ViewToLL(vs[6]));
+        block.startPoint.emplace_back(ViewToDouble(vs[7]),ViewToDouble(vs[8]));
+        block.endPoint.emplace_back(ViewToDouble(vs[9]), ViewToDouble(vs[10]));
+        int index_i=11;
+        int tempInt=ListSize(vs, index_i, line);
+        for(int i=0;i<tempInt;++i){
+            block.links.emplace_back(ViewToLL(vs[index_i++]));
+        }
+        tempInt=ListSize(vs, index_i, line);
+        for(int i=0;i<tempInt;++i){
+            block.linkTime.emplace_back(ViewToLL(vs[index_i++]));
+        }
+        tempInt=ListSize(vs, index_i, line);
+        for(int i=0;i<tempInt;++i){
+            block.linkSpeed.emplace_back(ViewToLL(vs[index_i++]));
+        }
+        tempInt=ListSize(vs, index_i, line);
+        for(int i=0;i<tempInt;++i){
+            block.linkCity.emplace_back(ViewToLL(vs[index_i++]));
+        }
+        block.linkOffset.emplace_back(block.links.size()), block.timeOffset.emplace_back(block.linkTime.size());
+        block.speedOffset.emplace_back(block.linkSpeed.size()), block.cityOffset.emplace_back(block.linkCity.size());
+    }
+    return block.size()>0;
+}
+
+//function of reading the size of a list field of a text trajectory row and checking that the row is long enough
+int ListSize(const vector<string_view>& vs, int& index_i, string_view line)
+{
+    if(index_i>=vs.size()){
+        cout << "Wrong syntax! " <<vs.size() <<" : "<< line << endl;
+        exit(1);
+    }
+    int tempInt=ViewToLL(vs[index_i]);
+    index_i++;
+    if(tempInt<0 || index_i+tempInt>vs.size()){
+        cout << "Wrong syntax! " <<vs.size() <<" : "<< line << endl;
+        exit(1);
+    }
+    return tempInt;
+}
+
+//function of appending values as zigzag varints of the differences to the previous value, the first value is compared with base
+template <class T>
+void EncodeDeltaVarint(string& bytes, const T* values, size_t num, long long int base)
+{
+    long long int prev=base;
+    for(size_t i=0;i<num;++i){
+        long long int delta=(long long int)values[i]-prev;
+        prev=values[i];
+        unsigned long long int v=((unsigned long long int)delta<<1)^(unsigned long long int)(delta>>63);//zigzag, small negative deltas stay small
+        while(v>=0x80){
+            bytes.push_back((char)(v|0x80));
+            v>>=7;
+        }
+        bytes.push_back((char)v);
+    }
+}
+
+template <class T>
+void DecodeDeltaVarint(const unsigned char*& p, const unsigned char* end, T* values, size_t num, long long int base)
+{
+    long long int prev=base;
+    for(size_t i=0;i<num;++i){
+        unsigned long long int v;
+        if(p<end && *p<0x80){//most deltas fit in one byte
+            v=*p++;
+        }else{
+            v=0;
+            int shift=0;
+            while(true){
+                if(p>=end || shift>63){
+                    cout<<"Wrong varint in binary trajectory file!"<<endl; exit(1);
                 }
-                OF<<endl;
+                unsigned char c=*p++;
+                v|=(unsigned long long int)(c&0x7f)<<shift;
+                if(c<0x80) break;
+                shift+=7;
             }
-            OF.close();
-            tt.stop();
-            sourceFiles.push_back(outputFile);
-            cout<<"CPU elapsed time: "<<tt.GetRuntime()<<" s."<<endl;
         }
+        prev+=(long long int)(v>>1)^-(long long int)(v&1);
+        values[i]=prev;
     }
+}
 
+template <class T>
+void WriteColumn(ofstream& OF, const vector<T>& column)
+{
+    OF.write((const char*)column.data(), column.size()*sizeof(T));
+}
 
+template <class T>
+void ReadColumn(const MappedFile& IF, size_t& pos, vector<T>& column, size_t num)
+{
+    if(pos+num*sizeof(T)>IF.size){
+        cout<<"Wrong binary trajectory file! "<<pos<<" "<<num<<" "<<IF.size<<endl; exit(1);
+    }
+    column.resize(num);
+    memcpy((void*)column.data(), IF.data+pos, num*sizeof(T));
+    pos+=num*sizeof(T);
 }
 
 
@@ -2296,6 +3238,86 @@ vector<string> split(const string &s, const string &seperator)
 }
 
 
+//function of choosing the query vertex of a trajectory start (end) point: the closer endpoint of its first (last) link, or the nearest vertex if that endpoint is too far, -1 if no vertex is near
+int QueryVertex(const pair<int,int>& edgeNode, const pair<double,double>& point, const vector<pair<double,double>>& Coordinate, const VertexGrid& grid, int& snapNum)
+{
+    double dis1= EuclideanDis(Coordinate[edgeNode.first],point);
+    double dis2= EuclideanDis(Coordinate[edgeNode.second],point);
+    if(dis1<=dis2 && dis1<=querySnapDis){//check which endpoint of the edge is closer to the point
+        return edgeNode.first;
+    }else if(dis2<dis1 && dis2<=querySnapDis){
+        return edgeNode.second;
+    }
+    double dis;
+    int ID=grid.Nearest(point, querySnapDis, dis);
+    if(ID>=0) snapNum++;
+    return ID;
+}
+
+//function of bucketing the vertices into about 2 vertices per cell
+void VertexGrid::Build(const vector<pair<double,double>>& Coordinate)
+{
+    coordinate=&Coordinate;
+    xNum=yNum=0;
+    cellStart.clear(); cellVertex.clear();
+    if(Coordinate.empty()) return;
+    double maxLon=Coordinate[0].first, maxLat=Coordinate[0].second;
+    minLon=maxLon, minLat=maxLat;
+    for(auto& p: Coordinate){
+        minLon=min(minLon,p.first), maxLon=max(maxLon,p.first);
+        minLat=min(minLat,p.second), maxLat=max(maxLat,p.second);
+    }
+    double area=max((maxLon-minLon)*(maxLat-minLat),1e-12);
+    cellSize=max(sqrt(area*2/Coordinate.size()),1e-6);
+    xNum=(int)((maxLon-minLon)/cellSize)+1, yNum=(int)((maxLat-minLat)/cellSize)+1;
+    maxAbsLat=max(fabs(minLat),fabs(maxLat));
+    cellStart.assign((size_t)xNum*yNum+1,0);
+    vector<int> cell(Coordinate.size());
+    for(int i=0;i<Coordinate.size();++i){
+        int x=(int)((Coordinate[i].first-minLon)/cellSize), y=(int)((Coordinate[i].second-minLat)/cellSize);
+        cell[i]=y*xNum+x;
+        cellStart[cell[i]+1]++;
+    }
+    for(size_t c=0;c+1<cellStart.size();++c) cellStart[c+1]+=cellStart[c];
+    cellVertex.assign(Coordinate.size(),0);
+    vector<int> fill(cellStart.begin(),cellStart.end()-1);
+    for(int i=0;i<Coordinate.size();++i){
+        cellVertex[fill[cell[i]]++]=i;
+    }
+}
+
+//function of searching the cells ring by ring around the point, return -1 if no vertex is within maxDis
+int VertexGrid::Nearest(const pair<double,double>& point, double maxDis, double& dis) const
+{
+    dis=INT32_MAX;
+    if(xNum==0) return -1;
+    int best=-1;
+    int cx=(int)floor((point.first-minLon)/cellSize), cy=(int)floor((point.second-minLat)/cellSize);
+    int maxRing=max(max(cx,xNum-1-cx),max(cy,yNum-1-cy));
+    double absLat=max(maxAbsLat,fabs(point.second));
+    double minScale=EuclideanDis(make_pair(0.0,absLat), make_pair(1.0,absLat));//one degree of longitude at the largest latitude of the vertices and the point, lower bound of the EuclideanDis of one degree
+    for(int r=0;r<=maxRing;++r){
+        double bound=(r-1)*cellSize*minScale;//any vertex of ring r is at least this far
+        if(bound>maxDis || (best>=0 && bound>dis)) break;
+        for(int y=cy-r;y<=cy+r;++y){
+            if(y<0 || y>=yNum) continue;
+            int step=(y==cy-r || y==cy+r) ? 1 : 2*r;//inner rows only have the two border cells
+            for(int x=cx-r;x<=cx+r;x+=max(step,1)){
+                if(x<0 || x>=xNum) continue;
+                int c=y*xNum+x;
+                for(int k=cellStart[c];k<cellStart[c+1];++k){
+                    double d=EuclideanDis((*coordinate)[cellVertex[k]],point);
+                    if(d<dis || (d==dis && cellVertex[k]<best)){
+                        dis=d, best=cellVertex[k];
+                    }
+                }
+            }
+        }
+    }
+    if(dis>maxDis) return -1;
+    return best;
+}
+
 //function of computing Euclidean distance, longitude and latitude
 double EuclideanDis(pair<double,double> s, pair<double,double> t)
 {